@@ -1,7 +1,7 @@
 #pragma once
 
 
-#include "utils.h"
+#include "column.h"
 
 
 #include <iostream>
@@ -9,53 +9,38 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
-#include <any>
 #include <bitset>
 
 
 namespace trecs {
 
-    using entity_t = uint32_t;
-    using comp_id_t = uint64_t;
-    using archetype_id_t = uint64_t;
-
-    using comprow_t = std::vector<std::any>;
-    using comptable_t = std::unordered_map<comp_id_t, comprow_t>;
+    using comptable_t = std::pmr::unordered_map<comp_id_t, column_t>;
 
     struct archetype_t;
-    using archetype_edge_t = std::unordered_map<comp_id_t, archetype_t*>;
-
-    using entry_data_t = std::unordered_map<comp_id_t, std::any>;
-    struct entry_t {
-        entry_data_t entry;
-        entity_t updatedEntity = 0;
-    };
-
-
-    static uint32_t __comp_type_ctr__ = 0;
-    template<typename t>
-    inline comp_id_t _get_comp_type_id(){
-        static comp_id_t id = 1ull << __comp_type_ctr__++;
-        return id;
-    }
-// this macro is usable only inside templated methods, to make things easier... 
-#define __ctype__ _get_comp_type_id<T>()
+    using archetype_edge_t = std::pmr::unordered_map<comp_id_t, archetype_t*>;
 
 
     struct archetype_t {
         private:
-        std::vector<entity_t> _entities;
+        std::pmr::vector<entity_t> _entities;
         
         public:
-        archetype_id_t id = 0;
+        archetype_id_t id;
+        size_t serial = 0; // dense index of the archetype inside its registry
+        size_t version = 0; // bumped whenever rows are added, removed or reordered
         comptable_t table;
 
         archetype_edge_t plus;
         archetype_edge_t minus;
 
-        inline comprow_t& operator[](comp_id_t id){
+        archetype_t(archetype_id_t id_ = {}, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            :_entities(resource), id(id_), table(resource), plus(resource), minus(resource){
+            id.for_each([&](comp_id_t c_id){ table.try_emplace(c_id, &_comp_info(c_id), resource); });
+        }
+
+        inline column_t& operator[](comp_id_t id){
             Assert(table.find(id) != table.end(), "archetype doesnot have component");
-            return table[id];
+            return table.find(id)->second;
         }
 
         inline size_t size(){
@@ -66,9 +51,13 @@ namespace trecs {
              return _entities.at(index);
         }
 
+        inline const entity_t* entities() const {
+            return _entities.data();
+        }
+
         template<typename... T>
         inline std::tuple<T...> get(size_t index){
-            return std::make_tuple(std::any_cast<T>(table[__ctype__].at(index))...);
+            return std::make_tuple((*this)[__ctype__].template get<T>(index)...);
         }
 
         inline comptable_t::iterator begin(){
@@ -114,31 +103,92 @@ namespace trecs {
             return archetype;
         }
 
-        inline entry_t remove_entry(size_t index){
-            entry_t entr;
-            if(!_entities.size()) return entr;
-            for(auto& [c_id, vec]:table){
-                entr.entry[c_id] = std::move(vec[index]);
-                if(index != vec.size()-1){
-                    vec[index] = std::move(vec.back());
-                    if(!entr.updatedEntity){
-                        _entities[index] = _entities.back();
-                        entr.updatedEntity = _entities[index];
+        /*
+         * makes room for count more rows in every column and the entity list, growing
+         * geometrically; mutations reserve first so a refused allocation leaves the rows intact
+         */
+        inline void reserve_more(size_t count){
+            for(auto& [c_id, col]: table) col.reserve_more(count);
+            const size_t need = _entities.size() + count;
+            if(need > _entities.capacity()) _entities.reserve(std::max(need, 2 * _entities.capacity()));
+        }
+
+        /*
+         * moves the row at index to the end of dst, destroying the components dst does not have;
+         * columns only dst has are left one row short for the caller to push into.
+         * Returns the entity that was moved into index to fill the hole, 0 if none
+         */
+        inline entity_t move_entry(size_t index, archetype_t& dst, entity_t entity){
+            if(dst.id) dst.reserve_more(1); // may throw, nothing has moved yet
+            entity_t updatedEntity = 0;
+            if(_entities.size()){
+                for(auto& [c_id, col]: table){
+                    auto it = dst.table.find(c_id);
+                    if(it != dst.table.end()){
+                        it->second.push_row(col, index);
+                        col.swap_remove_relocated(index);
+                    } else {
+                        col.swap_remove(index);
                     }
                 }
-                vec.pop_back(); 
+                if(index != _entities.size()-1){
+                    _entities[index] = _entities.back();
+                    updatedEntity = _entities[index];
+                }
+                _entities.pop_back();
+            }
+            if(dst.id) dst._entities.push_back(entity); //root never holds rows
+            version++;
+            dst.version++;
+            return updatedEntity;
+        }
+
+        /*moves every row of src, an archetype with the same id, behind the rows of this one*/
+        inline size_t splice(archetype_t& src, const std::vector<entity_t>& entities){
+            Assert(src.id == id, "Cannot splice rows of a different archetype");
+            const size_t base = _entities.size();
+            reserve_more(src.size());
+            for(auto& [c_id, col]: src.table) table.find(c_id)->second.append_move(col);
+            _entities.insert(_entities.end(), entities.begin(), entities.end());
+            src._entities.clear();
+            version++;
+            src.version++;
+            return base;
+        }
+
+        /*appends count copies of the row at index, owned by the entities first, first+1, ...*/
+        inline size_t clone_rows(size_t index, size_t count, entity_t first){
+            const size_t base = _entities.size();
+            reserve_more(count);
+            for(auto& [c_id, col]: table) col.append_copies(index, count);
+            for(size_t i = 0; i < count; i++) _entities.push_back(first + i);
+            version++;
+            return base;
+        }
+
+        /*
+         * reorders the rows so that row i becomes the old row order[i]. Every buffer is
+         * allocated before any row moves, so a failed allocation leaves the archetype untouched
+         */
+        inline void permute(const std::vector<size_t>& order){
+            Assert(order.size() == _entities.size(), "Permutation does not cover every row");
+            std::pmr::vector<entity_t> entities(_entities.get_allocator());
+            entities.reserve(order.size());
+            std::vector<std::pair<column_t*, column_t>> fresh;
+            fresh.reserve(table.size());
+            for(auto& [c_id, col]: table){
+                fresh.emplace_back(&col, column_t(col.info, table.get_allocator().resource()));
+                fresh.back().second.reserve(order.size());
             }
-            _entities.pop_back();
-            return entr;
-        }
 
-        inline size_t add_entry(entry_t& entry){
-            if(entry.entry.begin() == entry.entry.end()) return 0; //special case
-            for(auto& [c_id, comp]: entry.entry){
-                table[c_id].push_back(comp);
+            for(size_t i: order) entities.push_back(_entities[i]);
+            _entities.swap(entities);
+            for(auto& [col, dst]: fresh){
+                for(size_t i: order) dst.push_row(*col, i);
+                col->swap(dst);
+                dst.drop_relocated(); // only frees the old buffers, their rows live on in col
             }
-            _entities.push_back(entry.updatedEntity);
-            return _entities.size()-1;
+            version++;
         }
     };
 }
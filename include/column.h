@@ -0,0 +1,358 @@
+#pragma once
+
+
+#include "mask.h"
+#include "memory.h"
+
+
+#include <inttypes.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string>
+#include <typeinfo>
+#include <type_traits>
+#include <unordered_map>
+
+
+namespace trecs {
+
+    using entity_t = uint32_t;
+    using archetype_id_t = comp_mask_t;
+
+    /*
+     * Lifetime operations of a component that is stored as raw bytes.
+     * A nullptr operation means the bytes can be handled directly: construct zero fills,
+     * copy and move are memcpy and destroy does nothing.
+     */
+    struct comp_ops_t {
+        void (*construct)(void* dst) = nullptr;
+        void (*copy)(void* dst, const void* src) = nullptr;
+        void (*move)(void* dst, void* src) = nullptr;
+        void (*destroy)(void* ptr) = nullptr;
+    };
+
+    struct comp_info_t {
+        std::string name;
+        size_t size = 0;
+        size_t align = 1;
+        comp_ops_t ops;
+        bool doubleBuffered = false;
+        bool zeroFill = true; // false if a row cannot be default constructed by zero filling it
+    };
+
+    /*
+     * Specialize to std::true_type before the component is first used to give its columns a
+     * front buffer, read through get/view, and a back buffer, written through write/each_buffered.
+     * registry_t::swap_buffers<T>() flips them.
+     */
+    template<typename T>
+    struct double_buffered_t : std::false_type {};
+
+    using comp_info_map_t = std::unordered_map<comp_id_t, comp_info_t>;
+
+    /*every component type ever registered, shared by all registries*/
+    inline comp_info_map_t& _comp_infos(){
+        static comp_info_map_t infos;
+        return infos;
+    }
+
+    /*ids of the components registered at runtime by name, kept apart from the C++ type names*/
+    inline std::unordered_map<std::string, comp_id_t>& _dynamic_comps(){
+        static std::unordered_map<std::string, comp_id_t> ids;
+        return ids;
+    }
+
+    inline const comp_info_t& _comp_info(comp_id_t id){
+        auto it = _comp_infos().find(id);
+        Assert(it != _comp_infos().end(), "Unknown component type");
+        return it->second;
+    }
+
+    static uint32_t __comp_type_ctr__ = 0;
+    inline comp_id_t _register_comp_type(comp_info_t info){
+        Assert(__comp_type_ctr__ < TRECS_MAX_COMPONENTS, "Ran out of component type ids, raise TRECS_MAX_COMPONENTS");
+        comp_id_t id = __comp_type_ctr__++;
+        _comp_infos().emplace(id, std::move(info));
+        return id;
+    }
+
+    template<typename T>
+    inline comp_info_t _make_comp_info(){
+        comp_info_t info{typeid(T).name(), sizeof(T), alignof(T), {}, double_buffered_t<T>::value};
+        if constexpr(std::is_default_constructible_v<T>){
+            info.ops.construct = [](void* dst){ new(dst) T(); };
+        }
+        info.zeroFill = std::is_trivially_default_constructible_v<T>;
+        if constexpr(!std::is_trivially_copyable_v<T>){
+            info.ops.copy = [](void* dst, const void* src){ new(dst) T(*static_cast<const T*>(src)); };
+            info.ops.move = [](void* dst, void* src){ new(dst) T(std::move(*static_cast<T*>(src))); };
+        }
+        if constexpr(!std::is_trivially_destructible_v<T>){
+            info.ops.destroy = [](void* ptr){ static_cast<T*>(ptr)->~T(); };
+        }
+        return info;
+    }
+
+    template<typename T>
+    inline comp_id_t _get_comp_type_id(){
+        static comp_id_t id = _register_comp_type(_make_comp_info<T>());
+        return id;
+    }
+// this macro is usable only inside templated methods, to make things easier...
+#define __ctype__ _get_comp_type_id<T>()
+
+    template<typename... T>
+    inline comp_mask_t _get_comp_mask(){
+        comp_mask_t mask;
+        (mask.set(_get_comp_type_id<T>()), ...);
+        return mask;
+    }
+
+
+    /*
+     * contiguous, type erased storage of one component type inside an archetype.
+     * Double buffered components keep a second buffer of the same layout, every row operation
+     * is applied to both so rows stay aligned
+     */
+    struct column_t {
+        const comp_info_t* info = nullptr;
+
+        column_t(const comp_info_t* info_ = nullptr,
+                std::pmr::memory_resource* resource_ = std::pmr::get_default_resource())
+            :info(info_), _resource(resource_){}
+        column_t(const column_t&) = delete;
+        column_t(column_t&& other) noexcept {
+            swap(other);
+        }
+        inline column_t& operator=(column_t&& other) noexcept {
+            swap(other);
+            return *this;
+        }
+        ~column_t(){
+            clear();
+            _free(_data, _capacity);
+            _free(_back, _capacity);
+        }
+
+        inline size_t size() const {
+            return _size;
+        }
+
+        inline void* data(){
+            return _data;
+        }
+
+        inline void* back_data(){
+            return _back;
+        }
+
+        inline void* at(size_t index){
+            Assert(index < _size, "Column index out of range");
+            return _data + index * info->size;
+        }
+
+        inline void* back_at(size_t index){
+            Assert(_back && index < _size, "Column index out of range or not double buffered");
+            return _back + index * info->size;
+        }
+
+        template<typename T>
+        inline T& get(size_t index){
+            return *static_cast<T*>(at(index));
+        }
+
+        /*both buffers are allocated before anything moves, a failed allocation changes nothing*/
+        inline void reserve(size_t capacity){
+            if(capacity <= _capacity) return;
+            uint8_t* data = _alloc(capacity);
+            uint8_t* back = nullptr;
+            if(_buffered()){
+                try {
+                    back = _alloc(capacity);
+                } catch(...){
+                    _resource->deallocate(data, capacity * info->size, info->align);
+                    throw;
+                }
+            }
+            _relocate_n(data, _data, _size);
+            _free(_data, _capacity);
+            if(back){
+                _relocate_n(back, _back, _size);
+                _free(_back, _capacity);
+            }
+            _data = data;
+            _back = back;
+            _capacity = capacity;
+        }
+
+        /*makes room for count more rows, at least doubling so repeated appends stay amortized*/
+        inline void reserve_more(size_t count){
+            if(_size + count <= _capacity) return;
+            reserve(std::max(_size + count, _capacity ? _capacity * 2 : 8));
+        }
+
+        template<typename T>
+        inline T* emplace(T&& value){
+            T* ptr = new(_push_uninit()) T(std::forward<T>(value));
+            _mirror_last();
+            return ptr;
+        }
+
+        inline void push_copy(const void* src){
+            void* dst = _push_uninit();
+            if(info->ops.copy) info->ops.copy(dst, src);
+            else std::memcpy(dst, src, info->size);
+            _mirror_last();
+        }
+
+        inline void push_default(){
+            Assert(info->ops.construct || info->zeroFill, "Component cannot be default constructed");
+            void* dst = _push_uninit();
+            if(info->ops.construct) info->ops.construct(dst);
+            else std::memset(dst, 0, info->size);
+            _mirror_last();
+        }
+
+        /*
+         * relocates row index of src, a column of the same component, to a new last row.
+         * The source row is left as raw bytes, drop it with src.swap_remove_relocated(index)
+         */
+        inline void push_row(column_t& src, size_t index){
+            void* dst = _push_uninit();
+            _relocate(dst, src.at(index));
+            if(_buffered()) _relocate(_back + (_size-1) * info->size, src.back_at(index));
+        }
+
+        /*destroys the row at index and moves the last row into its place*/
+        inline void swap_remove(size_t index){
+            Assert(index < _size, "Column index out of range");
+            _swap_remove(_data, index, true);
+            if(_buffered()) _swap_remove(_back, index, true);
+            _size--;
+        }
+
+        /*same as swap_remove for a row that push_row already relocated, it is not destroyed again*/
+        inline void swap_remove_relocated(size_t index){
+            Assert(index < _size, "Column index out of range");
+            _swap_remove(_data, index, false);
+            if(_buffered()) _swap_remove(_back, index, false);
+            _size--;
+        }
+
+        /*forgets every row without destroying them, for columns whose rows were all relocated*/
+        inline void drop_relocated(){
+            _size = 0;
+        }
+
+        /*moves all rows of src behind the rows of this column, src is left empty*/
+        inline void append_move(column_t& src){
+            if(!src._size) return;
+            if(!_size && _resource->is_equal(*src._resource)){
+                std::swap(_data, src._data);
+                std::swap(_back, src._back);
+                std::swap(_size, src._size);
+                std::swap(_capacity, src._capacity);
+                src.clear();
+                return;
+            }
+            reserve_more(src._size);
+            _relocate_n(_data + _size * info->size, src._data, src._size);
+            if(_buffered()) _relocate_n(_back + _size * info->size, src._back, src._size);
+            _size += src._size;
+            src._size = 0;
+        }
+
+        /*appends count copies of the row at index, both buffers get the front value*/
+        inline void append_copies(size_t index, size_t count){
+            reserve_more(count);
+            const void* src = at(index);
+            _copy_n(_data + _size * info->size, src, count);
+            if(_buffered()) _copy_n(_back + _size * info->size, src, count);
+            _size += count;
+        }
+
+        /*flips front and back buffers, no rows are copied*/
+        inline void swap_buffers(){
+            if(_buffered()) std::swap(_data, _back);
+        }
+
+        inline void clear(){
+            if(info && info->ops.destroy){
+                for(size_t i = 0; i < _size; i++) info->ops.destroy(_data + i * info->size);
+                if(_back) for(size_t i = 0; i < _size; i++) info->ops.destroy(_back + i * info->size);
+            }
+            _size = 0;
+        }
+
+        inline void swap(column_t& other) noexcept {
+            std::swap(info, other.info);
+            std::swap(_resource, other._resource);
+            std::swap(_data, other._data);
+            std::swap(_back, other._back);
+            std::swap(_size, other._size);
+            std::swap(_capacity, other._capacity);
+        }
+
+        private:
+        std::pmr::memory_resource* _resource = nullptr;
+        uint8_t* _data = nullptr;
+        uint8_t* _back = nullptr;
+        size_t _size = 0;
+        size_t _capacity = 0;
+
+        inline bool _buffered() const {
+            return info->doubleBuffered;
+        }
+
+        /*grows by one row and returns it unconstructed, the caller must construct it*/
+        inline void* _push_uninit(){
+            reserve_more(1);
+            return _data + _size++ * info->size;
+        }
+
+        /*copy constructs the back row of the last row from its front row*/
+        inline void _mirror_last(){
+            if(!_buffered()) return;
+            _copy_n(_back + (_size-1) * info->size, _data + (_size-1) * info->size, 1);
+        }
+
+        inline uint8_t* _alloc(size_t capacity){
+            return static_cast<uint8_t*>(_resource->allocate(capacity * info->size, info->align));
+        }
+
+        inline void _free(uint8_t* data, size_t capacity){
+            if(data) _resource->deallocate(data, capacity * info->size, info->align);
+        }
+
+        inline void _copy_n(uint8_t* dst, const void* src, size_t count){
+            if(!info->ops.copy){
+                for(size_t i = 0; i < count; i++) std::memcpy(dst + i * info->size, src, info->size);
+            } else {
+                for(size_t i = 0; i < count; i++) info->ops.copy(dst + i * info->size, src);
+            }
+        }
+
+        /*move constructs dst from src and destroys src*/
+        inline void _relocate(void* dst, void* src){
+            if(!info->ops.move){
+                std::memcpy(dst, src, info->size);
+                return;
+            }
+            info->ops.move(dst, src);
+            if(info->ops.destroy) info->ops.destroy(src);
+        }
+
+        inline void _relocate_n(uint8_t* dst, uint8_t* src, size_t count){
+            if(!count) return;
+            if(!info->ops.move) std::memcpy(dst, src, count * info->size);
+            else for(size_t i = 0; i < count; i++) _relocate(dst + i * info->size, src + i * info->size);
+        }
+
+        inline void _swap_remove(uint8_t* buffer, size_t index, bool destroy){
+            uint8_t* ptr = buffer + index * info->size;
+            if(destroy && info->ops.destroy) info->ops.destroy(ptr);
+            if(index != _size-1) _relocate(ptr, buffer + (_size-1) * info->size);
+        }
+    };
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+
+#include "archetype.h"
+
+
+namespace trecs {
+
+    /*links of an entity inside the scene graph, indexed by entity id*/
+    struct hierarchy_node_t {
+        entity_t parent = 0;
+        entity_t firstChild = 0;
+        entity_t nextSibling = 0;
+        entity_t prevSibling = 0;
+        uint32_t depth = 0;
+        size_t slot = 0; // position inside its level bucket
+        bool linked = false; // true if the entity has a parent or any child
+    };
+
+    using hierarchy_nodes_t = std::vector<hierarchy_node_t>;
+    using hierarchy_level_t = std::vector<entity_t>;
+
+    struct hierarchy_parent_t {
+        archetype_t* arch = nullptr;
+        size_t index = 0;
+    };
+
+    /*
+     * rows of one archetype sorted for hierarchical traversal: rows [starts[d], starts[d+1])
+     * hold the entities at depth d, grouped by parent, rows past starts.back() are not linked.
+     * parents[i - starts[1]] is where the parent of row i lives, deps are the archetypes those
+     * parents are in along with the version they were looked up at
+     */
+    struct hierarchy_span_t {
+        archetype_t* arch = nullptr;
+        size_t version = SIZE_MAX; // arch->version the layout was computed at
+        size_t hierarchy = SIZE_MAX; // hierarchy version the layout was computed at
+        std::vector<size_t> levelVersions; // hierarchy levelVersions the layout was computed at
+        std::vector<size_t> starts;
+        std::vector<hierarchy_parent_t> parents;
+        std::vector<std::pair<archetype_t*, size_t>> deps;
+    };
+
+    /*sorted layout of every archetype holding a component, archetypes counts those seen so far*/
+    struct hierarchy_order_t {
+        size_t archetypes = 0;
+        std::vector<hierarchy_span_t> spans;
+    };
+
+    using hierarchy_orders_t = std::unordered_map<comp_id_t, hierarchy_order_t>;
+
+    /*
+     * Keeps parent/first-child/sibling links and buckets every linked entity by its depth,
+     * so that walking the levels in order visits each parent before any of its children.
+     * Reparenting only touches the moved subtree.
+     */
+    struct hierarchy_t {
+        std::vector<hierarchy_level_t> levels;
+        std::vector<size_t> levelVersions; // version of the last change inside each level
+        size_t version = 0; // bumped on every change of links or depths
+
+        inline bool linked(entity_t entity) const {
+            const entity_t ind = __entity_id__(entity);
+            return ind < _nodes.size() && _nodes[ind].linked;
+        }
+
+        inline const hierarchy_node_t& node(entity_t entity){
+            return _node(entity);
+        }
+
+        inline void attach(entity_t child, entity_t parent){
+            Assert(__entity_id__(child) != __entity_id__(parent), "Entity cannot be its own parent");
+            for(entity_t a = parent; a; a = _node(a).parent){
+                Assert(__entity_id__(a) != __entity_id__(child), "Reparenting would create a cycle");
+            }
+            version++;
+            _unlink_parent(child);
+
+            hierarchy_node_t& pn = _node(parent);
+            if(!pn.linked) _insert_level(parent, 0);
+
+            hierarchy_node_t& cn = _node(child);
+            cn.parent = parent;
+            cn.prevSibling = 0;
+            cn.nextSibling = pn.firstChild;
+            if(pn.firstChild) _node(pn.firstChild).prevSibling = child;
+            pn.firstChild = child;
+
+            _relevel(child);
+            levelVersions[_node(child).depth] = version; // its parent changed even if its depth did not
+        }
+
+        inline void detach(entity_t child){
+            if(!linked(child) || !_node(child).parent) return;
+            version++;
+            _unlink_parent(child);
+            if(_node(child).firstChild) _relevel(child);
+            else _erase_level(child);
+        }
+
+        /*removes entity from the graph, its children become roots*/
+        inline void erase(entity_t entity){
+            if(!linked(entity)) return;
+            version++;
+            _unlink_parent(entity);
+            entity_t c = _node(entity).firstChild;
+            while(c){
+                hierarchy_node_t& cn = _node(c);
+                entity_t next = cn.nextSibling;
+                cn.parent = cn.prevSibling = cn.nextSibling = 0;
+                if(cn.firstChild) _relevel(c);
+                else _erase_level(c);
+                c = next;
+            }
+            _node(entity).firstChild = 0;
+            _erase_level(entity);
+        }
+
+        private:
+        hierarchy_nodes_t _nodes;
+
+        inline hierarchy_node_t& _node(entity_t entity){
+            const entity_t ind = __entity_id__(entity);
+            if(ind >= _nodes.size()) _nodes.resize(ind+1);
+            return _nodes[ind];
+        }
+
+        /*cuts the entity out of its parent's child list, leaves its own subtree intact*/
+        inline void _unlink_parent(entity_t entity){
+            hierarchy_node_t& n = _node(entity);
+            if(!n.parent) return;
+            entity_t parent = n.parent;
+            if(n.prevSibling) _node(n.prevSibling).nextSibling = n.nextSibling;
+            else _node(parent).firstChild = n.nextSibling;
+            if(n.nextSibling) _node(n.nextSibling).prevSibling = n.prevSibling;
+            n.parent = n.prevSibling = n.nextSibling = 0;
+
+            hierarchy_node_t& pn = _node(parent);
+            if(!pn.firstChild && !pn.parent) _erase_level(parent);
+        }
+
+        inline void _insert_level(entity_t entity, uint32_t depth){
+            if(levels.size() <= depth){
+                levels.resize(depth+1);
+                levelVersions.resize(depth+1);
+            }
+            levelVersions[depth] = version;
+            hierarchy_node_t& n = _node(entity);
+            n.depth = depth;
+            n.slot = levels[depth].size();
+            n.linked = true;
+            levels[depth].push_back(entity);
+        }
+
+        inline void _erase_level(entity_t entity){
+            hierarchy_node_t& n = _node(entity);
+            if(!n.linked) return;
+            hierarchy_level_t& bucket = levels[n.depth];
+            levelVersions[n.depth] = version;
+            entity_t last = bucket.back();
+            bucket[n.slot] = last;
+            _node(last).slot = n.slot;
+            bucket.pop_back();
+            n.linked = false;
+        }
+
+        /*recomputes depth of the subtree rooted at entity from its (new) parent*/
+        inline void _relevel(entity_t entity){
+            std::vector<entity_t> stack{entity};
+            while(!stack.empty()){
+                entity_t e = stack.back();
+                stack.pop_back();
+                hierarchy_node_t& n = _node(e);
+                uint32_t depth = n.parent ? _node(n.parent).depth + 1 : 0;
+                if(!n.linked || n.depth != depth){
+                    _erase_level(e);
+                    _insert_level(e, depth);
+                }
+                for(entity_t c = _node(e).firstChild; c; c = _node(c).nextSibling){
+                    stack.push_back(c);
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+
+#include "archetype.h"
+#include <functional>
+#include <memory>
+#include <map>
+#include <type_traits>
+
+
+namespace trecs {
+
+    /*type erased hook, the registry calls it on every mutation of the indexed component*/
+    struct index_base_t {
+        virtual ~index_base_t() = default;
+        virtual void set(entity_t entity, const void* comp) = 0;
+        virtual void erase(entity_t entity) = 0;
+    };
+
+    using index_list_t = std::vector<std::unique_ptr<index_base_t>>;
+    using index_map_t = std::unordered_map<comp_id_t, index_list_t>;
+
+    /*
+     * Secondary index from a key computed out of component T to the entities holding it.
+     * Map is a multimap type, hashed (O(1) lookup) or ordered (O(log n) lookup and ranges).
+     * Only mutations done through the registry are tracked, so values edited in place through
+     * get() or a view must be written back with update() to stay indexed.
+     */
+    template<typename T, typename K, typename Map>
+    struct index_t : index_base_t {
+        using key_t = K;
+        using key_fn_t = std::function<K(const T&)>;
+        using iterator = typename Map::const_iterator;
+
+        index_t(key_fn_t key_fn):_key_fn(std::move(key_fn)){}
+
+        inline void set(entity_t entity, const void* comp) override {
+            K key = _key_fn(*static_cast<const T*>(comp));
+            auto it = _keys.find(entity);
+            if(it != _keys.end()){
+                if(it->second == key) return;
+                _erase_entry(it->second, entity);
+                it->second = key;
+            } else {
+                _keys.emplace(entity, key);
+            }
+            _map.emplace(std::move(key), entity);
+        }
+
+        inline void erase(entity_t entity) override {
+            auto it = _keys.find(entity);
+            if(it == _keys.end()) return;
+            _erase_entry(it->second, entity);
+            _keys.erase(it);
+        }
+
+        /*returns any entity with the key, 0 if there is none*/
+        inline entity_t find(const K& key) const {
+            auto it = _map.find(key);
+            return it == _map.end() ? 0 : it->second;
+        }
+
+        inline std::vector<entity_t> find_all(const K& key) const {
+            std::vector<entity_t> out;
+            auto [b, e] = _map.equal_range(key);
+            for(; b != e; ++b) out.push_back(b->second);
+            return out;
+        }
+
+        inline size_t count(const K& key) const {
+            return _map.count(key);
+        }
+
+        /*entities with keys in [lo, hi), only available on ordered indexes*/
+        inline std::vector<entity_t> range(const K& lo, const K& hi) const {
+            std::vector<entity_t> out;
+            for(auto it = _map.lower_bound(lo), e = _map.lower_bound(hi); it != e; ++it){
+                out.push_back(it->second);
+            }
+            return out;
+        }
+
+        inline size_t size() const {
+            return _keys.size();
+        }
+
+        inline iterator begin() const {
+            return _map.cbegin();
+        }
+        inline iterator end() const {
+            return _map.cend();
+        }
+
+        private:
+        key_fn_t _key_fn;
+        Map _map;
+        std::unordered_map<entity_t, K> _keys;
+
+        inline void _erase_entry(const K& key, entity_t entity){
+            auto [b, e] = _map.equal_range(key);
+            for(; b != e; ++b){
+                if(b->second == entity){
+                    _map.erase(b);
+                    return;
+                }
+            }
+        }
+    };
+
+    template<typename T, typename K>
+    using hash_index_t = index_t<T, K, std::unordered_multimap<K, entity_t>>;
+
+    template<typename T, typename K>
+    using ordered_index_t = index_t<T, K, std::multimap<K, entity_t>>;
+
+    template<typename T, typename F>
+    using index_key_t = std::decay_t<std::invoke_result_t<F, const T&>>;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+
+#include "utils.h"
+
+
+#include <inttypes.h>
+#include <cstddef>
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+#ifndef TRECS_MAX_COMPONENTS
+// maximum number of component types, can be raised before including trecs
+#   define TRECS_MAX_COMPONENTS 256
+#endif
+
+
+namespace trecs {
+
+    using comp_id_t = uint32_t;
+
+    /*
+     * Fixed width bitset of component ids, used as archetype id and for view matching.
+     * All operations work on whole words so that the compiler (or the SSE2 path) can
+     * process the mask as a few vector registers.
+     */
+    struct comp_mask_t {
+        static constexpr size_t words = (TRECS_MAX_COMPONENTS + 63) / 64;
+        alignas(16) uint64_t bits[words] = {};
+
+        inline bool test(comp_id_t c) const {
+            return bits[c >> 6] & (1ull << (c & 63));
+        }
+        inline comp_mask_t& set(comp_id_t c){
+            bits[c >> 6] |= 1ull << (c & 63);
+            return *this;
+        }
+        inline comp_mask_t& reset(comp_id_t c){
+            bits[c >> 6] &= ~(1ull << (c & 63));
+            return *this;
+        }
+
+        inline comp_mask_t with(comp_id_t c) const {
+            comp_mask_t m = *this;
+            return m.set(c);
+        }
+        inline comp_mask_t without(comp_id_t c) const {
+            comp_mask_t m = *this;
+            return m.reset(c);
+        }
+
+        /*true if every bit of sub is also set here*/
+        inline bool contains(const comp_mask_t& sub) const {
+#if defined(__SSE2__)
+            if constexpr(words % 2 == 0){
+                __m128i miss = _mm_setzero_si128();
+                for(size_t i = 0; i < words; i += 2){
+                    __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(bits + i));
+                    __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(sub.bits + i));
+                    miss = _mm_or_si128(miss, _mm_andnot_si128(a, b));
+                }
+                return _mm_movemask_epi8(_mm_cmpeq_epi8(miss, _mm_setzero_si128())) == 0xffff;
+            }
+#endif
+            uint64_t miss = 0;
+            for(size_t i = 0; i < words; i++) miss |= sub.bits[i] & ~bits[i];
+            return !miss;
+        }
+
+        inline bool intersects(const comp_mask_t& other) const {
+            uint64_t hit = 0;
+            for(size_t i = 0; i < words; i++) hit |= bits[i] & other.bits[i];
+            return hit;
+        }
+
+        inline explicit operator bool() const {
+            uint64_t any = 0;
+            for(size_t i = 0; i < words; i++) any |= bits[i];
+            return any;
+        }
+
+        inline comp_mask_t operator|(const comp_mask_t& other) const {
+            comp_mask_t m;
+            for(size_t i = 0; i < words; i++) m.bits[i] = bits[i] | other.bits[i];
+            return m;
+        }
+        inline comp_mask_t operator&(const comp_mask_t& other) const {
+            comp_mask_t m;
+            for(size_t i = 0; i < words; i++) m.bits[i] = bits[i] & other.bits[i];
+            return m;
+        }
+        inline bool operator==(const comp_mask_t& other) const {
+            uint64_t diff = 0;
+            for(size_t i = 0; i < words; i++) diff |= bits[i] ^ other.bits[i];
+            return !diff;
+        }
+        inline bool operator!=(const comp_mask_t& other) const {
+            return !(*this == other);
+        }
+
+        /*calls fn with every set component id, in increasing order*/
+        template<typename F>
+        inline void for_each(F fn) const {
+            for(size_t i = 0; i < words; i++){
+                for(uint64_t w = bits[i]; w; w &= w-1){
+                    fn(static_cast<comp_id_t>(i * 64 + __builtin_ctzll(w)));
+                }
+            }
+        }
+
+        inline size_t hash() const {
+            uint64_t h = 0x9e3779b97f4a7c15ull;
+            for(size_t i = 0; i < words; i++){
+                h ^= bits[i];
+                h *= 0xff51afd7ed558ccdull;
+                h ^= h >> 32;
+            }
+            return static_cast<size_t>(h);
+        }
+    };
+
+    struct comp_mask_hash_t {
+        inline size_t operator()(const comp_mask_t& mask) const {
+            return mask.hash();
+        }
+    };
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+
+#include "utils.h"
+
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <memory_resource>
+
+
+namespace trecs {
+
+    /*
+     * Memory resource that forwards to upstream while keeping track of the bytes it handed out.
+     * Allocations that would go over the cap throw std::bad_alloc, as memory resources do.
+     */
+    struct memory_budget_t : std::pmr::memory_resource {
+        memory_budget_t(size_t cap_ = SIZE_MAX,
+                std::pmr::memory_resource* upstream_ = std::pmr::get_default_resource())
+            :_upstream(upstream_), _cap(cap_){}
+
+        inline size_t used() const {
+            return _used;
+        }
+
+        inline size_t peak() const {
+            return _peak;
+        }
+
+        inline size_t cap() const {
+            return _cap;
+        }
+
+        /*lowering the cap below the current usage only blocks further allocations*/
+        inline void set_cap(size_t cap_){
+            _cap = cap_;
+        }
+
+        protected:
+        inline void* do_allocate(size_t bytes, size_t alignment) override {
+            if(bytes > _cap - std::min(_used, _cap)) throw std::bad_alloc();
+            void* ptr = _upstream->allocate(bytes, alignment);
+            _used += bytes;
+            if(_used > _peak) _peak = _used;
+            return ptr;
+        }
+
+        inline void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+            _upstream->deallocate(ptr, bytes, alignment);
+            _used -= bytes;
+        }
+
+        inline bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+        private:
+        std::pmr::memory_resource* _upstream;
+        size_t _cap;
+        size_t _used = 0;
+        size_t _peak = 0;
+    };
+}
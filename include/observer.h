@@ -0,0 +1,86 @@
+#pragma once
+
+
+#include "archetype.h"
+#include <functional>
+#include <memory>
+
+
+namespace trecs {
+
+    using entity_batch_t = std::vector<entity_t>;
+
+    /*type erased event buffer of a single component type*/
+    struct observer_base_t {
+        virtual ~observer_base_t() = default;
+        virtual void push_added(entity_t entity) = 0;
+        virtual void push_updated(entity_t entity) = 0;
+        virtual void push_removed(entity_t entity, void* comp) = 0;
+        virtual void flush() = 0;
+    };
+
+    using observer_map_t = std::unordered_map<comp_id_t, std::unique_ptr<observer_base_t>>;
+
+    /*
+     * Buffers the lifecycle events of component T until flush, then hands each handler the
+     * whole batch at once. Removed components are moved into the buffer along with their
+     * entities, so on_remove handlers can still release what the component owned.
+     * Events of a batch may be stale: an added entity can lose T again before the flush.
+     */
+    template<typename T>
+    struct observer_t : observer_base_t {
+        using batch_fn_t = std::function<void(const entity_batch_t&)>;
+        using remove_fn_t = std::function<void(const entity_batch_t&, std::vector<T>&)>;
+
+        std::vector<batch_fn_t> addHandlers;
+        std::vector<batch_fn_t> updateHandlers;
+        std::vector<remove_fn_t> removeHandlers;
+
+        inline void push_added(entity_t entity) override {
+            _added.push_back(entity);
+        }
+
+        inline void push_updated(entity_t entity) override {
+            _updated.push_back(entity);
+        }
+
+        inline void push_removed(entity_t entity, void* comp) override {
+            _removed.push_back(entity);
+            _removedComps.push_back(std::move(*static_cast<T*>(comp)));
+        }
+
+        /*handlers may touch the registry, events they raise go to the next flush*/
+        inline void flush() override {
+            _deliver(_added, addHandlers);
+            _deliver(_updated, updateHandlers);
+
+            if(_removed.empty()) return;
+            entity_batch_t batch;
+            std::vector<T> comps;
+            batch.swap(_removed);
+            comps.swap(_removedComps);
+            for(auto& fn: removeHandlers) fn(batch, comps);
+            batch.clear();
+            comps.clear();
+            if(_removed.empty()){
+                _removed.swap(batch);
+                _removedComps.swap(comps);
+            }
+        }
+
+        private:
+        entity_batch_t _added;
+        entity_batch_t _updated;
+        entity_batch_t _removed;
+        std::vector<T> _removedComps;
+
+        inline void _deliver(entity_batch_t& events, std::vector<batch_fn_t>& handlers){
+            if(events.empty()) return;
+            entity_batch_t batch;
+            batch.swap(events);
+            for(auto& fn: handlers) fn(batch);
+            batch.clear();
+            if(events.empty()) events.swap(batch); // keep the capacity for the next frame
+        }
+    };
+}
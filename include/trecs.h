@@ -5,18 +5,22 @@
  * written for its usage in the game engine - Everest. It has efficient implementation
  * for adding, removing, quering or getting the components from entities. It uses
  * archetype graph method for organizing data neatly, so that there is no memory wastage
- * or leak. Entities recycling is also supported by the way. As of now it supports 64
- * different component types, which should be enough for any game engine.
+ * or leak. Entities recycling is also supported by the way. It supports TRECS_MAX_COMPONENTS
+ * (256 by default) different component types, define it before including to change it.
  */
 
 #pragma once
 
 
 #include "archetype.h"
+#include "hierarchy.h"
+#include "index.h"
+#include "observer.h"
 #include <functional>
-
-#define __entity_id__(x) (x & 0x00ffffff)
-#define __entity_rc__(x) (x & 0xff000000)
+#include <array>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 
 namespace trecs {
@@ -30,24 +34,43 @@ namespace trecs {
     };
 
     using view_id_t = archetype_id_t;
-    using archetype_map_t = std::unordered_map<archetype_id_t, archetype_t>;
-    using entity_records_t = std::vector<record_t>;
-    using recycleReg_t = std::vector<entity_t>;
+    using archetype_map_t = std::pmr::unordered_map<archetype_id_t, archetype_t, comp_mask_hash_t>;
+    using entity_records_t = std::pmr::vector<record_t>;
+    using recycleReg_t = std::pmr::vector<entity_t>;
+    using entity_map_t = std::unordered_map<entity_t, entity_t>;
+
+    /*entities with consecutive ids, as returned by registry_t::instantiate*/
+    struct entity_range_t {
+        entity_t first = 0;
+        size_t count = 0;
+
+        struct iterator {
+            entity_t entity;
+            inline entity_t operator*() const { return entity; }
+            inline iterator& operator++(){ ++entity; return *this; }
+            inline bool operator!=(const iterator& other) const { return entity != other.entity; }
+        };
+
+        inline size_t size() const { return count; }
+        inline entity_t operator[](size_t i) const { return first + i; }
+        inline iterator begin() const { return {first}; }
+        inline iterator end() const { return {static_cast<entity_t>(first + count)}; }
+    };
 
     template<typename... T>
     struct view_t {
-        view_id_t id = 0;
+        view_id_t id;
 
         inline void forEach(const std::function<void(T&...)>& callback){
             size_t i = 0;
             archetype_map_t::iterator _cur_arch = _archmap.begin();
             archetype_map_t::iterator _end_arch = _archmap.end();
             while(1){
-                while(i >= _cur_arch->second.size() || (_cur_arch->first & id) != id){
+                while(i >= _cur_arch->second.size() || !_cur_arch->first.contains(id)){
                     if(++_cur_arch == _end_arch) return;
                     i = 0;
                 }
-                callback(std::any_cast<T&>(_cur_arch->second[__ctype__].at(i)) ...);
+                callback(_cur_arch->second[__ctype__].template get<T>(i) ...);
                 i++;
             }
         }
@@ -57,11 +80,11 @@ namespace trecs {
             archetype_map_t::iterator _cur_arch = _archmap.begin();
             archetype_map_t::iterator _end_arch = _archmap.end();
             while(1){
-                while(i >= _cur_arch->second.size() || (_cur_arch->first & id) != id){
+                while(i >= _cur_arch->second.size() || !_cur_arch->first.contains(id)){
                     if(++_cur_arch == _end_arch) return;
                     i = 0;
                 }
-                callback(std::any_cast<T&>(_cur_arch->second[__ctype__].at(i)) ...,
+                callback(_cur_arch->second[__ctype__].template get<T>(i) ...,
                         _cur_arch->second.entityAt(i));
                 i++;
             }
@@ -74,38 +97,262 @@ namespace trecs {
         view_t(view_id_t id_, archetype_map_t& arch_):id(id_), _archmap(arch_){}
     };
 
+    /*
+     * Random access to the components T... of arbitrary entities. Column pointers are cached per
+     * archetype, so a lookup is one record load and an indexed read, with no hashing.
+     * The accessor stays valid across structural changes of the registry.
+     */
+    template<typename... T>
+    struct accessor_t {
+        template<typename U>
+        inline U& get(const entity_t entity){
+            const record_t& rec = _records[__entity_id__(entity)];
+            column_t* col = _columns(rec.archeType)[_slot<U>()];
+            Assert(col, "Entity does not have the component");
+            return static_cast<U*>(col->data())[rec.index];
+        }
+
+        /*returns nullptr instead of asserting when the entity lacks U*/
+        template<typename U>
+        inline U* try_get(const entity_t entity){
+            const record_t& rec = _records[__entity_id__(entity)];
+            column_t* col = _columns(rec.archeType)[_slot<U>()];
+            return col ? static_cast<U*>(col->data()) + rec.index : nullptr;
+        }
+
+        /*
+         * resolves U of every entity into out (nullptr for entities without U), in input order.
+         * Records are prefetched a few entities ahead and runs of entities sharing an archetype
+         * reuse the resolved column
+         */
+        template<typename U>
+        inline void get_many(const std::vector<entity_t>& entities, std::vector<U*>& out){
+            constexpr size_t ahead = 8;
+            const size_t n = entities.size();
+            out.resize(n);
+            for(size_t i = 0; i < n && i < ahead; i++) Prefetch(&_records[__entity_id__(entities[i])]);
+
+            archetype_t* arch = nullptr;
+            U* base = nullptr;
+            for(size_t i = 0; i < n; i++){
+                if(i + ahead < n) Prefetch(&_records[__entity_id__(entities[i + ahead])]);
+                const record_t& rec = _records[__entity_id__(entities[i])];
+                if(rec.archeType != arch){
+                    arch = rec.archeType;
+                    column_t* col = _columns(arch)[_slot<U>()];
+                    base = col ? static_cast<U*>(col->data()) : nullptr;
+                }
+                out[i] = base ? base + rec.index : nullptr;
+                if(base) Prefetch(out[i]);
+            }
+        }
+
+        private:
+        using columns_t = std::array<column_t*, sizeof...(T)>;
+
+        entity_records_t& _records;
+        std::vector<columns_t> _cache;
+        std::vector<bool> _cached;
+        friend class registry_t;
+
+        accessor_t(entity_records_t& records_):_records(records_){}
+
+        template<typename U>
+        static constexpr size_t _slot(){
+            constexpr bool match[] = {std::is_same_v<U, T>...};
+            size_t i = 0;
+            while(i < sizeof...(T) && !match[i]) i++;
+            static_assert((std::is_same_v<U, T> || ...), "Component is not part of the accessor");
+            return i;
+        }
+
+        inline columns_t& _columns(archetype_t* arch){
+            if(arch->serial >= _cache.size()){
+                _cache.resize(arch->serial + 1);
+                _cached.resize(arch->serial + 1);
+            }
+            columns_t& cols = _cache[arch->serial];
+            if(!_cached[arch->serial]){
+                cols = {(arch->id.test(_get_comp_type_id<T>()) ? &(*arch)[_get_comp_type_id<T>()] : nullptr)...};
+                _cached[arch->serial] = true;
+            }
+            return cols;
+        }
+    };
+
+    /*view over components known only by id, e.g. ones registered at runtime by scripts*/
+    struct raw_view_t {
+        view_id_t id;
+
+        /*columns holds one pointer per requested component, in request order, each `count` rows long*/
+        using chunk_fn_t = std::function<void(void* const* columns, const entity_t* entities, size_t count)>;
+
+        /*calls back once per matching archetype with its raw columns*/
+        inline void forEach(const chunk_fn_t& callback){
+            std::vector<void*> columns(_comps.size());
+            for(auto& [a_id, arch]: _archmap){
+                if(!arch.size() || !a_id.contains(id)) continue;
+                for(size_t c = 0; c < _comps.size(); c++) columns[c] = arch[_comps[c]].data();
+                callback(columns.data(), arch.entities(), arch.size());
+            }
+        }
+
+        private:
+        archetype_map_t& _archmap;
+        std::vector<comp_id_t> _comps;
+        friend class registry_t;
+
+        raw_view_t(const std::vector<comp_id_t>& comps, archetype_map_t& arch_):_archmap(arch_), _comps(comps){
+            for(comp_id_t c: comps) id.set(c);
+        }
+    };
+
     class registry_t {
         public:
-            registry_t(){
-                _archetypeStore[0] = {/*root*/};
+            /*
+             * All archetype storage (columns, entity lists, the archetype store, records and
+             * the recycle register)
+             * comes from a size-class pool owned by the registry, which draws from upstream
+             * through a budget of memoryCap bytes. Going over the cap throws std::bad_alloc; every
+             * mutation reserves before it moves rows, so a refused entity stays as it was
+             * (a refused merge may have moved some archetypes already)
+             */
+            registry_t(std::pmr::memory_resource* upstream = std::pmr::get_default_resource(),
+                    size_t memoryCap = SIZE_MAX)
+                :_budget(std::make_unique<memory_budget_t>(memoryCap, upstream)),
+                _pool(std::make_unique<std::pmr::unsynchronized_pool_resource>(_budget.get())),
+                _records(_pool.get()), _archetypeStore(_pool.get()), _recycleReg(_pool.get()){
+                _root = &_archetypeStore.try_emplace(archetype_id_t{}, archetype_id_t{}, _pool.get()).first->second;
                 _records.push_back({}); // leave first slot empty, entity 0 never exists
             }
 
+            /*
+             * takes over the storage of other, which may only be destroyed afterwards. Archetypes,
+             * indexes and observers stay where they are; views and accessors of other do not
+             * follow, fetch new ones. Must not run concurrently with reserve_entity on other
+             */
+            registry_t(registry_t&& other)
+                :_budget(std::move(other._budget)), _pool(std::move(other._pool)),
+                _records(std::move(other._records)), _archetypeStore(std::move(other._archetypeStore)),
+                _root(other._root), _recycleReg(std::move(other._recycleReg)),
+                _hierarchy(std::move(other._hierarchy)), _hierarchyOrders(std::move(other._hierarchyOrders)),
+                _placed(std::move(other._placed)), _indexes(std::move(other._indexes)),
+                _indexedMask(other._indexedMask), _observers(std::move(other._observers)),
+                _addObserved(other._addObserved), _updateObserved(other._updateObserved),
+                _removeObserved(other._removeObserved),
+                __entity_generator(other.__entity_generator.load(std::memory_order_relaxed)),
+                _recycleTaken(other._recycleTaken.load(std::memory_order_relaxed)){
+                other._root = nullptr;
+            }
+
+            registry_t& operator=(registry_t&&) = delete;
+
+            /*Memory Ops*/
+            /*bytes the registry's storage currently holds from upstream, pooled free blocks included*/
+            inline size_t memory_usage() const {
+                return _budget->used();
+            }
+
+            inline size_t memory_peak() const {
+                return _budget->peak();
+            }
+
+            inline void set_memory_cap(size_t bytes){
+                _budget->set_cap(bytes);
+            }
+
             /*Entity Ops*/
 
             /*creates an entity*/
             inline entity_t create(){
-                while(!_recycleReg.empty()){
-                    int en = _recycleReg.back();
+                sync();
+                if(!_recycleReg.empty()){
+                    entity_t en = _recycleReg.back();
                     _recycleReg.pop_back();
-                    int rc = __entity_rc__(en);
-                    if(rc < 0xff){
-                        return ((rc+1)<<24) | __entity_id__(en);
-                    }
+                    return _next_generation(en);
                 }
 
-                _records.push_back(record_t{&_archetypeStore[0], 0});
+                _records.push_back(record_t{_root, 0});
                 return ++__entity_generator;
             }
 
+            /*
+             * hands out a valid entity id without touching the records, so it may be called from
+             * many threads at once, as long as no other registry op runs meanwhile.
+             * The entity becomes usable after the next sync() (create/destroy sync as well)
+             */
+            inline entity_t reserve_entity(){
+                const size_t k = _recycleTaken.fetch_add(1, std::memory_order_relaxed);
+                if(k < _recycleReg.size()) return _next_generation(_recycleReg[_recycleReg.size()-1-k]);
+                return __entity_generator.fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+
+            /*same as reserve_entity, but touches each shared counter once for the whole batch*/
+            inline void reserve_entities(size_t count, std::vector<entity_t>& out){
+                const size_t k = _recycleTaken.fetch_add(count, std::memory_order_relaxed);
+                const size_t avail = _recycleReg.size();
+                size_t i = 0;
+                for(; i < count && k+i < avail; i++) out.push_back(_next_generation(_recycleReg[avail-1-k-i]));
+                if(i == count) return;
+                const entity_t first = __entity_generator.fetch_add(count-i, std::memory_order_relaxed) + 1;
+                for(entity_t e = first; i < count; i++, e++) out.push_back(e);
+            }
+
+            /*materializes the records of the entities handed out by reserve_entity*/
+            inline void sync(){
+                if(size_t taken = _recycleTaken.load(std::memory_order_relaxed)){
+                    _recycleReg.resize(_recycleReg.size() - std::min(taken, _recycleReg.size()));
+                    _recycleTaken.store(0, std::memory_order_relaxed);
+                }
+                if(_records.size() <= __entity_generator){
+                    _records.resize(__entity_generator + 1, record_t{_root, 0});
+                }
+            }
+
+            /*
+             * creates count copies of prototype with all of its components, the rows are copied
+             * into the prototype's archetype in bulk. Ids are always fresh (never recycled) so the
+             * result is one consecutive range; hierarchy links are not copied
+             */
+            inline entity_range_t instantiate(const entity_t prototype, size_t count){
+                sync();
+                const entity_t ind = __entity_id__(prototype);
+                Assert(ind < _records.size(), "Invalid entity");
+                const record_t proto = _records[ind];
+                entity_range_t range{__entity_generator + 1, count};
+                if(!count) return range;
+
+                // reserved before any row is cloned, a refused allocation leaves the registry as it was
+                _reserve_more(_records, count);
+                archetype_t* arch = proto.archeType;
+                const size_t base = arch->id ? arch->clone_rows(proto.index, count, range.first) : 0;
+                for(size_t i = 0; i < count; i++){
+                    _records.push_back(record_t{arch, arch->id ? base+i : 0});
+                }
+                __entity_generator += count;
+                if(arch->id.intersects(_indexedMask | _addObserved)) _notify_appended(*arch, base);
+                return range;
+            }
+
             inline void destroy(entity_t entity){
-                Assert(__entity_id__(entity) <= _records.size(), "Invalid entity");
+                sync();
+                Assert(__entity_id__(entity) < _records.size(), "Invalid entity");
                 const entity_t ind = __entity_id__(entity);
                 record_t& rec = _records[ind];
-                auto en = rec.archeType->remove_entry(rec.index);
-                if(en.updatedEntity) _records[__entity_id__(en.updatedEntity)].index = rec.index;
-                rec.archeType = &_archetypeStore[0];
-                _recycleReg.push_back(entity);
+                archetype_t* arch = rec.archeType;
+                _reserve_more(_recycleReg, 1);
+                if(arch->id.intersects(_indexedMask)) _index_erase(arch->id, entity);
+                if(arch->id.intersects(_removeObserved)){
+                    for(auto& [c_id, col]: *arch){
+                        if(_removeObserved.test(c_id)) _observers[c_id]->push_removed(entity, col.at(rec.index));
+                    }
+                }
+                entity_t updated = arch->move_entry(rec.index, *_root, entity);
+                if(updated) _records[__entity_id__(updated)].index = rec.index;
+                rec.archeType = _root;
+                rec.index = 0;
+                _hierarchy.erase(entity);
+                _release(entity);
             }
 
             /*Component Ops*/
@@ -123,35 +370,30 @@ namespace trecs {
                 else add<T>(entity, data);
             }
 
+            /*
+             * double buffered components are written to the back buffer, readers see the value
+             * (and indexes and on_update get it) after the next swap_buffers<T>()
+             */
             template<typename T>
             inline void update(const entity_t entity, T data){
                 const entity_t ind = __entity_id__(entity);
                 Assert(ind < _records.size(), "Invalid entity");
                 record_t& rec = _records[ind];
-                Assert(rec.archeType->id & __ctype__, "Entity does not have the component to update");
-                (*rec.archeType)[__ctype__][rec.index] = data;
+                Assert(rec.archeType->id.test(__ctype__), "Entity does not have the component to update");
+                if constexpr(double_buffered_t<T>::value){
+                    *static_cast<T*>((*rec.archeType)[__ctype__].back_at(rec.index)) = std::move(data);
+                    return;
+                }
+                (*rec.archeType)[__ctype__].template get<T>(rec.index) = data;
+                if(_indexedMask.test(__ctype__)) _index_set(__ctype__, entity, &data);
+                if(_updateObserved.test(__ctype__)) _observers[__ctype__]->push_updated(entity);
             }
 
             template<typename T>
             void add(const entity_t entity, T data){
-                const entity_t ind = __entity_id__(entity);
-                Assert(ind < _records.size(), "Invalid entity");
                 comp_id_t c_id = __ctype__;
-                record_t& rec = _records[ind];
-                archetype_t *p_arch = rec.archeType;
-
-                Assert(!(p_arch->id & c_id), "Component already exists on the entity");
-                
-                archetype_t* n_arch = p_arch->has_plus(c_id)
-                    ? p_arch->get_plus(c_id)
-                    : p_arch->add_plus(c_id, _getNewArchetype(c_id | p_arch->id));
-
-                entry_t en = p_arch->remove_entry(rec.index);
-                en.entry[c_id] = data;
-                if(en.updatedEntity) _records[__entity_id__(en.updatedEntity)].index = rec.index;
-                en.updatedEntity = entity;
-                rec.index = n_arch->add_entry(en);
-                rec.archeType = n_arch;
+                column_t& col = _move_plus(entity, c_id);
+                _added(entity, c_id, col.emplace<T>(std::move(data)));
             }
 
             template<typename... T>
@@ -161,7 +403,7 @@ namespace trecs {
             
             template<typename... T>
             inline void remove(entity_t entity){
-                (_remove<T>(entity), ...);
+                (_remove(entity, _get_comp_type_id<T>()), ...);
             }
             
             template<typename... T>
@@ -188,62 +430,547 @@ namespace trecs {
             inline T& get(const entity_t entity){
                 const entity_t ind = __entity_id__(entity);
                 Assert(ind <= _records.size(), "Invalid entity");
-                Assert(_records[ind].archeType->id & __ctype__, "Entity does not have the component");
-                return std::any_cast<T&>((*_records[ind].archeType)[__ctype__]
-                        .at(_records[ind].index));
+                Assert(_records[ind].archeType->id.test(__ctype__), "Entity does not have the component");
+                return (*_records[ind].archeType)[__ctype__].template get<T>(_records[ind].index);
             }
 
             /*View Ops*/
             /*Returns the view to components*/
             template<typename... T>
             inline view_t<T...> view(){
-                view_t<T...> view((_get_comp_type_id<T>() | ...), _archetypeStore);
+                view_t<T...> view(_get_comp_mask<T...>(), _archetypeStore);
+                return view;
+            }
+
+            /*Dynamic Component Ops*/
+            /*
+             * registers a component type known only at runtime (e.g. defined by a script) and
+             * returns its id for the id based add/remove/has/get/view overloads below. Its rows
+             * are raw bytes handled through ops. Ids are shared by all registries, registering
+             * an already known name returns the existing id. Names never match C++ component types
+             */
+            inline comp_id_t register_dynamic_component(const std::string& name, size_t size,
+                    size_t align, const comp_ops_t& ops = {}){
+                Assert(size && align && !(align & (align-1)) && size % align == 0,
+                        "Dynamic component needs a power of two align that divides its non zero size");
+                auto it = _dynamic_comps().find(name);
+                if(it != _dynamic_comps().end()){
+                    const comp_info_t& info = _comp_info(it->second);
+                    Assert(info.size == size && info.align == align, "Component re-registered with a different layout");
+                    Assert(info.ops.construct == ops.construct && info.ops.copy == ops.copy
+                            && info.ops.move == ops.move && info.ops.destroy == ops.destroy,
+                            "Component re-registered with different ops");
+                    return it->second;
+                }
+                const comp_id_t c_id = _register_comp_type(comp_info_t{name, size, align, ops});
+                _dynamic_comps().emplace(name, c_id);
+                return c_id;
+            }
+
+            /*adds component c_id copied from data, or default constructed if data is nullptr*/
+            inline void add(const entity_t entity, comp_id_t c_id, const void* data = nullptr){
+                column_t& col = _move_plus(entity, c_id);
+                if(data) col.push_copy(data);
+                else col.push_default();
+                _added(entity, c_id, col.at(col.size()-1));
+            }
+
+            inline void remove(const entity_t entity, comp_id_t c_id){
+                _remove(entity, c_id);
+            }
+
+            inline bool has(const entity_t entity, comp_id_t c_id){
+                Assert(__entity_id__(entity) < _records.size(), "Invalid entity");
+                return _records[__entity_id__(entity)].archeType->id.test(c_id);
+            }
+
+            inline void* get(const entity_t entity, comp_id_t c_id){
+                const entity_t ind = __entity_id__(entity);
+                Assert(ind < _records.size(), "Invalid entity");
+                Assert(_records[ind].archeType->id.test(c_id), "Entity does not have the component");
+                return (*_records[ind].archeType)[c_id].at(_records[ind].index);
+            }
+
+            /*Returns a cached random access accessor to components*/
+            template<typename... T>
+            inline accessor_t<T...> accessor(){
+                accessor_t<T...> acc(_records);
+                return acc;
+            }
+
+            /*Returns the view to components given by id*/
+            inline raw_view_t view(const std::vector<comp_id_t>& comps){
+                raw_view_t view(comps, _archetypeStore);
                 return view;
             }
 
+            /*Double Buffer Ops*/
+            /*back buffer of a double buffered component, get() keeps reading the front one*/
+            template<typename T>
+            inline T& write(const entity_t entity){
+                static_assert(double_buffered_t<T>::value, "Component is not double buffered");
+                const entity_t ind = __entity_id__(entity);
+                Assert(ind < _records.size(), "Invalid entity");
+                Assert(_records[ind].archeType->id.test(__ctype__), "Entity does not have the component");
+                return *static_cast<T*>((*_records[ind].archeType)[__ctype__].back_at(_records[ind].index));
+            }
+
+            /*
+             * visits every T as (front, back, entity), readers of the front and this writer can
+             * run concurrently as long as no structural change happens meanwhile
+             */
+            template<typename T>
+            inline void each_buffered(const std::function<void(const T&, T&, entity_t)>& callback){
+                static_assert(double_buffered_t<T>::value, "Component is not double buffered");
+                for(auto& [a_id, arch]: _archetypeStore){
+                    if(!arch.size() || !a_id.test(__ctype__)) continue;
+                    column_t& col = arch[__ctype__];
+                    const T* front = static_cast<const T*>(col.data());
+                    T* back = static_cast<T*>(col.back_data());
+                    for(size_t i = 0; i < arch.size(); i++) callback(front[i], back[i], arch.entityAt(i));
+                }
+            }
+
+            /*
+             * publishes the back buffer of every T column by swapping it with the front one;
+             * the new back buffer holds the values from before the previous swap
+             */
+            template<typename T>
+            inline void swap_buffers(){
+                static_assert(double_buffered_t<T>::value, "Component is not double buffered");
+                const comp_id_t c_id = __ctype__;
+                for(auto& [a_id, arch]: _archetypeStore){
+                    if(!a_id.test(c_id)) continue;
+                    column_t& col = arch[c_id];
+                    col.swap_buffers();
+                    // every published value may have changed, indexes and observers see it now
+                    for(size_t i = 0; i < arch.size(); i++){
+                        if(_indexedMask.test(c_id)) _index_set(c_id, arch.entityAt(i), col.at(i));
+                        if(_updateObserved.test(c_id)) _observers[c_id]->push_updated(arch.entityAt(i));
+                    }
+                }
+            }
+
+            /*Hierarchy Ops*/
+            /*makes parent the parent of child, passing 0 as parent detaches the child*/
+            inline void set_parent(const entity_t child, const entity_t parent){
+                Assert(__entity_id__(child) < _records.size(), "Invalid entity");
+                Assert(__entity_id__(parent) < _records.size(), "Invalid parent entity");
+                if(parent) _hierarchy.attach(child, parent);
+                else _hierarchy.detach(child);
+            }
+
+            inline entity_t parent_of(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).parent : 0;
+            }
+
+            inline entity_t first_child(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).firstChild : 0;
+            }
+
+            inline entity_t next_sibling(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).nextSibling : 0;
+            }
+
+            inline uint32_t depth(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).depth : 0;
+            }
+
+            /*
+             * visits every (parent, child) pair level by level, so parents are always updated
+             * before their children; pairs where either side lacks T are skipped.
+             * Rows holding T are kept sorted by (depth, parent), re-sorting only archetypes whose
+             * rows moved or got relinked, and the parent row of every child is cached, so each
+             * level is a linear walk over the children and their (grouped) parents
+             */
+            template<typename T>
+            inline void each_hierarchical(const std::function<void(const T&, T&)>& callback){
+                const comp_id_t c_id = __ctype__;
+                hierarchy_order_t& order = _hierarchy_order(c_id);
+                for(size_t l = 1; l < _hierarchy.levels.size(); l++){
+                    for(hierarchy_span_t& span: order.spans){
+                        if(l+1 >= span.starts.size()) continue;
+                        T* rows = static_cast<T*>((*span.arch)[c_id].data());
+                        archetype_t* p_arch = nullptr;
+                        T* p_rows = nullptr;
+                        for(size_t i = span.starts[l]; i < span.starts[l+1]; i++){
+                            const hierarchy_parent_t& p = span.parents[i - span.starts[1]];
+                            if(p.arch != p_arch){
+                                p_arch = p.arch;
+                                p_rows = p_arch->id.test(c_id) ? static_cast<T*>((*p_arch)[c_id].data()) : nullptr;
+                            }
+                            if(p_rows) callback(p_rows[p.index], rows[i]);
+                        }
+                    }
+                }
+            }
+
+            /*Index Ops*/
+            /*creates a hashed index on key_fn(T), lookups by key are O(1)*/
+            template<typename T, typename F>
+            inline hash_index_t<T, index_key_t<T, F>>& index(F key_fn){
+                return _add_index<T, hash_index_t<T, index_key_t<T, F>>>(std::move(key_fn));
+            }
+
+            /*creates an ordered index on key_fn(T), lookups are O(log n) and ranges are supported*/
+            template<typename T, typename F>
+            inline ordered_index_t<T, index_key_t<T, F>>& ordered_index(F key_fn){
+                return _add_index<T, ordered_index_t<T, index_key_t<T, F>>>(std::move(key_fn));
+            }
+
+            /*Observer Ops*/
+            /*callback receives every entity that got T since the last flush_events*/
+            template<typename T>
+            inline void on_add(const typename observer_t<T>::batch_fn_t& callback){
+                _observer<T>().addHandlers.push_back(callback);
+                _addObserved.set(__ctype__);
+            }
+
+            /*callback receives every entity whose T was replaced through update/addOrUpdate*/
+            template<typename T>
+            inline void on_update(const typename observer_t<T>::batch_fn_t& callback){
+                _observer<T>().updateHandlers.push_back(callback);
+                _updateObserved.set(__ctype__);
+            }
+
+            /*callback receives the entities that lost T along with the removed components*/
+            template<typename T>
+            inline void on_remove(const typename observer_t<T>::remove_fn_t& callback){
+                _observer<T>().removeHandlers.push_back(callback);
+                _removeObserved.set(__ctype__);
+            }
+
+            /*delivers the buffered events, batched per component type*/
+            inline void flush_events(){
+                for(auto& [c_id, obs]: _observers) obs->flush();
+            }
+
+            /*Registry Ops*/
+            /*
+             * moves every entity of other into this registry, whole archetype columns at a time;
+             * returns other's entities mapped to the new ones. Entities without any component
+             * are not stored in an archetype, so they stay in other
+             */
+            inline entity_map_t merge(registry_t& other){
+                return _migrate(other, view_id_t{});
+            }
+
+            /*same as merge, but only for the entities of other matched by view (a view of other)*/
+            template<typename... T>
+            inline entity_map_t move_entities(registry_t& other, const view_t<T...>& view){
+                Assert(&view._archmap == &other._archetypeStore, "View does not belong to the source registry");
+                return _migrate(other, view.id);
+            }
+
         private:
             template<typename T>
             inline bool _has_findex(const size_t ind){
-                return __ctype__ & _records[ind].archeType->id;
+                return _records[ind].archeType->id.test(__ctype__);
             }
 
-            template<typename T>
-            inline void _remove(entity_t entity){
+            /*moves entity to the archetype with c_id added, returns the column to push c_id into*/
+            inline column_t& _move_plus(const entity_t entity, comp_id_t c_id){
+                const entity_t ind = __entity_id__(entity);
+                Assert(ind < _records.size(), "Invalid entity");
+                record_t& rec = _records[ind];
+                archetype_t *p_arch = rec.archeType;
+
+                Assert(!p_arch->id.test(c_id), "Component already exists on the entity");
+
+                archetype_t* n_arch = p_arch->has_plus(c_id)
+                    ? p_arch->get_plus(c_id)
+                    : p_arch->add_plus(c_id, _getNewArchetype(p_arch->id.with(c_id)));
+
+                entity_t updated = p_arch->move_entry(rec.index, *n_arch, entity);
+                if(updated) _records[__entity_id__(updated)].index = rec.index;
+                rec.index = n_arch->size()-1;
+                rec.archeType = n_arch;
+                return (*n_arch)[c_id];
+            }
+
+            inline void _added(const entity_t entity, comp_id_t c_id, const void* comp){
+                if(_indexedMask.test(c_id)) _index_set(c_id, entity, comp);
+                if(_addObserved.test(c_id)) _observers[c_id]->push_added(entity);
+            }
+
+            inline void _remove(entity_t entity, comp_id_t c_id){
                 const entity_t ind = __entity_id__(entity);
                 Assert(ind < _records.size(), "Invalid entity");
-                comp_id_t c_id = __ctype__;
 
                 record_t& rec = _records[ind];
                 archetype_t* p_arch = rec.archeType;
-                Assert(p_arch->id & c_id, "Attempt to remove non-existent component");
+                Assert(p_arch->id.test(c_id), "Attempt to remove non-existent component");
 
                 archetype_t* n_arch = p_arch->has_minus(c_id)
                     ? p_arch->get_minus(c_id)
-                    : p_arch->add_minus(c_id, _getNewArchetype(p_arch->id & (~c_id)));
+                    : p_arch->add_minus(c_id, _getNewArchetype(p_arch->id.without(c_id)));
 
-                entry_t en = p_arch->remove_entry(rec.index);
-                en.entry.erase(c_id);
-                if(en.updatedEntity) _records[__entity_id__(en.updatedEntity)].index = rec.index;
-                en.updatedEntity = entity;
-                rec.index = n_arch->add_entry(en);
+                if(n_arch->id) n_arch->reserve_more(1); // before the observer takes the component
+                if(_removeObserved.test(c_id)) _observers[c_id]->push_removed(entity, (*p_arch)[c_id].at(rec.index));
+                entity_t updated = p_arch->move_entry(rec.index, *n_arch, entity);
+                if(updated) _records[__entity_id__(updated)].index = rec.index;
+                rec.index = n_arch->id ? n_arch->size()-1 : 0;
                 rec.archeType = n_arch;
+                if(_indexedMask.test(c_id)) _index_erase(archetype_id_t{}.set(c_id), entity);
             }
 
             template<typename T>
             inline void _tryRemove(const entity_t entity){
-                if(has<T>(entity)) _remove<T>(entity);
+                if(has<T>(entity)) _remove(entity, __ctype__);
+            }
+
+            template<typename T, typename I, typename F>
+            inline I& _add_index(F key_fn){
+                const comp_id_t c_id = __ctype__;
+                auto idx = std::make_unique<I>(std::move(key_fn));
+                for(auto& [a_id, arch]: _archetypeStore){
+                    if(!a_id.test(c_id) || !arch.size()) continue;
+                    column_t& col = arch[c_id];
+                    for(size_t i = 0; i < arch.size(); i++) idx->set(arch.entityAt(i), col.at(i));
+                }
+                I& ref = *idx;
+                _indexes[c_id].push_back(std::move(idx));
+                _indexedMask.set(c_id);
+                return ref;
+            }
+
+            inline entity_map_t _migrate(registry_t& other, view_id_t mask){
+                Assert(&other != this, "Cannot migrate a registry into itself");
+                other.sync();
+                entity_map_t remap;
+                std::vector<entity_t> moved;
+                std::vector<std::pair<entity_t, entity_t>> links; // (old entity, old parent)
+                archetype_t* o_root = other._root;
+
+                for(auto& [a_id, src]: other._archetypeStore){
+                    if(!src.size() || !a_id.contains(mask)) continue;
+                    archetype_t* dst = _getNewArchetype(a_id);
+                    const size_t base = dst->size();
+                    // everything the loop below needs from either pool, so a refusal moves nothing
+                    dst->reserve_more(src.size());
+                    _reserve_more(_records, src.size());
+                    _reserve_more(other._recycleReg, src.size());
+                    moved.clear();
+                    for(size_t i = 0; i < src.size(); i++){
+                        const entity_t e_old = src.entityAt(i);
+                        const entity_t e_new = create();
+                        remap.emplace(e_old, e_new);
+                        moved.push_back(e_new);
+                        _records[__entity_id__(e_new)] = record_t{dst, base+i};
+
+                        other._records[__entity_id__(e_old)] = record_t{o_root, 0};
+                        other._release(e_old);
+                        if(a_id.intersects(other._indexedMask)) other._index_erase(a_id, e_old);
+                        if(other._hierarchy.linked(e_old)){
+                            links.emplace_back(e_old, other._hierarchy.node(e_old).parent);
+                        }
+                    }
+                    dst->splice(src, moved);
+                    if(a_id.intersects(_indexedMask | _addObserved)) _notify_appended(*dst, base);
+                }
+
+                for(auto& [e_old, parent]: links){
+                    auto p = remap.find(parent);
+                    if(p != remap.end()) set_parent(remap[e_old], p->second);
+                }
+                for(auto& link: links) other._hierarchy.erase(link.first);
+                return remap;
+            }
+
+            /*feeds the rows appended from base onwards to the indexes and add-observers*/
+            inline void _notify_appended(archetype_t& arch, size_t base){
+                for(auto& [c_id, col]: arch){
+                    if(_indexedMask.test(c_id)){
+                        for(auto& idx: _indexes[c_id]){
+                            for(size_t i = base; i < arch.size(); i++) idx->set(arch.entityAt(i), col.at(i));
+                        }
+                    }
+                    if(_addObserved.test(c_id)){
+                        for(size_t i = base; i < arch.size(); i++) _observers[c_id]->push_added(arch.entityAt(i));
+                    }
+                }
+            }
+
+            /*
+             * brings the sorted layout of every archetype holding c_id up to date. Only archetypes
+             * whose rows moved, or all of them after the hierarchy changed, are looked at: their
+             * rows are regrouped by depth and only the levels no longer sorted by parent are
+             * sorted again, top down so that the new position of each parent is known.
+             * Rows are moved only if that changed their order
+             */
+            inline hierarchy_order_t& _hierarchy_order(comp_id_t c_id){
+                hierarchy_order_t& order = _hierarchyOrders[c_id];
+                if(order.archetypes != _archetypeStore.size()){
+                    for(auto& [a_id, arch]: _archetypeStore){
+                        if(a_id.test(c_id) && arch.serial >= order.archetypes) order.spans.emplace_back().arch = &arch;
+                    }
+                    order.archetypes = _archetypeStore.size();
+                }
+
+                const size_t levels = _hierarchy.levels.size();
+                const std::vector<size_t>& versions = _hierarchy.levelVersions;
+                std::vector<hierarchy_span_t*> stale;
+                std::vector<std::vector<size_t>> perms;
+                for(hierarchy_span_t& span: order.spans){
+                    archetype_t& arch = *span.arch;
+                    if(span.version == arch.version && span.hierarchy == _hierarchy.version) continue;
+                    std::vector<size_t> starts(levels+2, 0);
+                    for(size_t i = 0; i < arch.size(); i++) starts[_row_depth(arch.entityAt(i), levels)+1]++;
+                    for(size_t d = 1; d < starts.size(); d++) starts[d] += starts[d-1];
+                    std::vector<size_t> perm(arch.size());
+                    std::vector<size_t> fill(starts.begin(), starts.end()-1);
+                    for(size_t i = 0; i < arch.size(); i++) perm[fill[_row_depth(arch.entityAt(i), levels)]++] = i;
+                    starts.pop_back(); // unlinked rows run to the end
+                    span.starts = std::move(starts);
+                    stale.push_back(&span);
+                    perms.push_back(std::move(perm));
+                }
+
+                if(!stale.empty()){
+                    std::vector<bool> moving(_archetypeStore.size(), false);
+                    for(hierarchy_span_t* span: stale) moving[span->arch->serial] = true;
+                    if(_placed.size() < _records.size()) _placed.resize(_records.size());
+
+                    // (parent archetype, parent row, parent, row), row last so the sort is stable
+                    using key_t = std::tuple<size_t, size_t, entity_t, size_t>;
+                    std::vector<key_t> keys;
+                    bool reordered = false; // rows of the level above changed their relative order
+                    for(size_t d = 0; d < levels; d++){
+                        bool reorders = false;
+                        for(size_t s = 0; s < stale.size(); s++){
+                            hierarchy_span_t& span = *stale[s];
+                            archetype_t& arch = *span.arch;
+                            auto b = perms[s].begin() + span.starts[d];
+                            auto e = perms[s].begin() + span.starts[d+1];
+                            // a level keeps its order unless its rows, their links or their parents' order changed
+                            const bool check = span.version != arch.version || reordered
+                                || d >= span.levelVersions.size() || span.levelVersions[d] != versions[d];
+                            if(d && check){
+                                keys.clear();
+                                for(auto it = b; it != e; ++it){
+                                    const entity_t pe = _hierarchy.node(arch.entityAt(*it)).parent;
+                                    const record_t& prec = _records[__entity_id__(pe)];
+                                    const size_t p_row = moving[prec.archeType->serial] ? _placed[__entity_id__(pe)] : prec.index;
+                                    keys.emplace_back(prec.archeType->serial, p_row, pe, *it);
+                                }
+                                if(!std::is_sorted(keys.begin(), keys.end())){
+                                    std::sort(keys.begin(), keys.end());
+                                    for(size_t k = 0; k < keys.size(); k++) b[k] = std::get<3>(keys[k]);
+                                }
+                            }
+                            for(auto it = b; it+1 < e && !reorders; ++it) reorders = *it > *(it+1);
+                            for(auto it = b; it != e; ++it){
+                                _placed[__entity_id__(arch.entityAt(*it))] = static_cast<size_t>(it - perms[s].begin());
+                            }
+                        }
+                        reordered = reorders;
+                    }
+
+                    for(size_t s = 0; s < stale.size(); s++){
+                        archetype_t& arch = *stale[s]->arch;
+                        const std::vector<size_t>& perm = perms[s];
+                        bool identity = true;
+                        for(size_t i = 0; i < perm.size() && identity; i++) identity = perm[i] == i;
+                        if(!identity){
+                            arch.permute(perm);
+                            for(size_t i = 0; i < arch.size(); i++) _records[__entity_id__(arch.entityAt(i))].index = i;
+                        }
+                        stale[s]->version = arch.version;
+                        stale[s]->hierarchy = _hierarchy.version;
+                        stale[s]->levelVersions = versions;
+                    }
+                }
+
+                // parent rows are looked up again wherever this span or a parent archetype changed
+                for(hierarchy_span_t& span: order.spans){
+                    bool changed = std::find(stale.begin(), stale.end(), &span) != stale.end();
+                    for(size_t i = 0; i < span.deps.size() && !changed; i++) changed = span.deps[i].first->version != span.deps[i].second;
+                    if(changed) _cache_parents(span);
+                }
+                return order;
+            }
+
+            /*depth of a linked entity, levels for the rest so that they sort last*/
+            inline size_t _row_depth(entity_t entity, size_t levels){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).depth : levels;
+            }
+
+            inline void _cache_parents(hierarchy_span_t& span){
+                archetype_t& arch = *span.arch;
+                span.parents.clear();
+                span.deps.clear();
+                if(span.starts.size() < 2) return;
+                for(size_t i = span.starts[1]; i < span.starts.back(); i++){
+                    const record_t& prec = _records[__entity_id__(_hierarchy.node(arch.entityAt(i)).parent)];
+                    span.parents.push_back({prec.archeType, prec.index});
+                    if(!span.deps.empty() && span.deps.back().first == prec.archeType) continue;
+                    auto same = [&](const std::pair<archetype_t*, size_t>& dep){ return dep.first == prec.archeType; };
+                    if(std::none_of(span.deps.begin(), span.deps.end(), same)) span.deps.emplace_back(prec.archeType, prec.archeType->version);
+                }
+            }
+
+            template<typename T>
+            inline observer_t<T>& _observer(){
+                auto& obs = _observers[__ctype__];
+                if(!obs) obs = std::make_unique<observer_t<T>>();
+                return static_cast<observer_t<T>&>(*obs);
+            }
+
+            inline void _index_set(comp_id_t c_id, entity_t entity, const void* comp){
+                for(auto& idx: _indexes[c_id]) idx->set(entity, comp);
+            }
+
+            /*drops entity from the indexes of every component in comps*/
+            inline void _index_erase(archetype_id_t comps, entity_t entity){
+                for(auto& [c_id, list]: _indexes){
+                    if(!comps.test(c_id)) continue;
+                    for(auto& idx: list) idx->erase(entity);
+                }
             }
 
         private:
+            // declared first so that they outlive the containers allocating from them, on the heap
+            // so that those containers keep a valid resource when the registry is moved
+            std::unique_ptr<memory_budget_t> _budget;
+            std::unique_ptr<std::pmr::unsynchronized_pool_resource> _pool;
             entity_records_t _records;
             archetype_map_t _archetypeStore;
+            archetype_t* _root;
             recycleReg_t _recycleReg;
-            entity_t __entity_generator = 0;
+            hierarchy_t _hierarchy;
+            hierarchy_orders_t _hierarchyOrders;
+            std::vector<size_t> _placed; // scratch of _hierarchy_order, new row of each sorted entity
+            index_map_t _indexes;
+            archetype_id_t _indexedMask;
+            observer_map_t _observers;
+            archetype_id_t _addObserved;
+            archetype_id_t _updateObserved;
+            archetype_id_t _removeObserved;
+            std::atomic<entity_t> __entity_generator{0};
+            std::atomic<size_t> _recycleTaken{0}; // recycled ids reserved from the back since the last sync
+
+            /*grows vec for count more elements, at least doubling so repeated calls stay amortized*/
+            template<typename V>
+            static inline void _reserve_more(V& vec, size_t count){
+                const size_t need = vec.size() + count;
+                if(need > vec.capacity()) vec.reserve(std::max(need, 2 * vec.capacity()));
+            }
+
+            /*handle of the next generation of a destroyed entity*/
+            static inline entity_t _next_generation(entity_t entity){
+                return (((__entity_rc__(entity) >> 24) + 1) << 24) | __entity_id__(entity);
+            }
+
+            /*queues a destroyed entity for reuse, unless its generation counter is exhausted*/
+            inline void _release(entity_t entity){
+                if((__entity_rc__(entity) >> 24) < 0xff) _recycleReg.push_back(entity);
+            }
 
             inline archetype_t* _getNewArchetype(archetype_id_t id){
-                if(_archetypeStore.find(id) != _archetypeStore.end()) return &_archetypeStore[id];
-                auto& a = _archetypeStore.try_emplace(id, archetype_t{}).first->second;
-                a.id = id;
+                auto it = _archetypeStore.find(id);
+                if(it != _archetypeStore.end()) return &it->second;
+                archetype_t& a = _archetypeStore.try_emplace(id, id, _pool.get()).first->second;
+                a.serial = _archetypeStore.size()-1;
                 return &a;
             }
     };
@@ -8,3 +8,12 @@
 #else
 #   define Assert(exp, msg)
 #endif
+
+#define __entity_id__(x) (x & 0x00ffffff)
+#define __entity_rc__(x) (x & 0xff000000)
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define Prefetch(ptr) __builtin_prefetch(ptr)
+#else
+#   define Prefetch(ptr)
+#endif
@@ -1,13 +1,43 @@
 #include "single-include/trecs.h"
 #include <cassert>
+#include <thread>
 
 #define __norm_cmds_test 1
+#define __hierarchy_test 1
+#define __index_test 1
+#define __observer_test 1
+#define __merge_test 1
+#define __instantiate_test 1
+#define __dynamic_test 1
+#define __wide_mask_test 1
+#define __accessor_test 1
+#define __double_buffer_test 1
+#define __reserve_test 1
+#define __memory_test 1
  
 
 struct position {
     float x=0,y=0;
 };
 
+struct velocity {
+    float x=0,y=0;
+};
+template<>
+struct trecs::double_buffered_t<velocity> : std::true_type {};
+
+template<int N>
+struct tag {
+    int v = N;
+};
+
+template<int... N>
+void add_tags(trecs::registry_t& reg, trecs::entity_t e, std::integer_sequence<int, N...>){
+    (reg.add<tag<N>>(e, {}), ...);
+}
+
+static int live_handles = 0;
+
 int main(){
     trecs::registry_t registry;
 
@@ -105,5 +135,562 @@ int main(){
 
 #endif
 
+#if __hierarchy_test
+    {
+        trecs::registry_t reg;
+        trecs::entity_t root = reg.create();
+        trecs::entity_t a = reg.create();
+        trecs::entity_t b = reg.create();
+        trecs::entity_t c = reg.create();
+
+        reg.add<position>(root, {1, 1});
+        reg.add<position>(a, {1, 0});
+        reg.add<position>(b, {0, 1});
+        reg.add<position>(c, {5, 5});
+
+        reg.set_parent(b, a);
+        reg.set_parent(a, root);
+        assert(reg.parent_of(b) == a && reg.parent_of(a) == root);
+        assert(reg.depth(root) == 0 && reg.depth(a) == 1 && reg.depth(b) == 2);
+        assert(reg.first_child(root) == a);
+
+        reg.each_hierarchical<position>([](const position& parent, position& child){
+                child.x += parent.x;
+                child.y += parent.y;
+            });
+        assert(reg.get<position>(a).x == 2.f && reg.get<position>(a).y == 1.f);
+        assert(reg.get<position>(b).x == 2.f && reg.get<position>(b).y == 2.f);
+        assert(reg.get<position>(c).x == 5.f);
+
+        reg.set_parent(b, c);
+        assert(reg.parent_of(b) == c && reg.depth(b) == 1 && !reg.first_child(a));
+        reg.set_parent(c, root);
+        assert(reg.depth(b) == 2 && reg.next_sibling(c) == a);
+
+        reg.destroy(c);
+        assert(reg.parent_of(b) == 0 && reg.depth(b) == 0 && reg.first_child(root) == a);
+
+        reg.set_parent(a, 0);
+        assert(reg.parent_of(a) == 0 && !reg.first_child(root));
+    }
+    {
+        // rows get sorted by depth, children still see their parent's final value
+        trecs::registry_t reg;
+        std::vector<trecs::entity_t> nodes;
+        for(int i = 0; i < 64; i++){
+            trecs::entity_t e = reg.create();
+            reg.add<position>(e, {1, 0});
+            if(i % 3 == 0) reg.add<int>(e, i);
+            nodes.push_back(e);
+        }
+        for(int i = 63; i > 0; i--) reg.set_parent(nodes[i], nodes[(i-1)/2]);
+        reg.each_hierarchical<position>([](const position& parent, position& child){
+                child.x += parent.x;
+            });
+        for(int i = 0; i < 64; i++) assert(reg.get<position>(nodes[i]).x == float(reg.depth(nodes[i]) + 1));
+
+        uint32_t last = 0;
+        reg.view<position>().forEach([&](position&, trecs::entity_t e){
+                if(reg.has<int>(e)) return;
+                assert(reg.depth(e) >= last);
+                last = reg.depth(e);
+            });
+        reg.remove<int>(nodes[3]);
+        reg.each_hierarchical<position>([](const position& parent, position& child){
+                child.x = parent.x + 1;
+            });
+        for(int i = 0; i < 64; i++) assert(reg.get<position>(nodes[i]).x == float(reg.depth(nodes[i]) + 1));
+
+        // once sorted, other hierarchical components and unrelated entities leave the rows alone
+        for(int i = 0; i < 64; i++) reg.add<float>(nodes[i], 1.f);
+        reg.each_hierarchical<float>([](const float& parent, float& child){ child = parent + 1; });
+        reg.each_hierarchical<position>([](const position&, position&){});
+        auto rows = [&](){
+            std::vector<trecs::entity_t> out;
+            reg.view<position>().forEach([&](position&, trecs::entity_t e){ out.push_back(e); });
+            return out;
+        };
+        const std::vector<trecs::entity_t> sorted = rows();
+        trecs::entity_t loose = reg.create();
+        reg.add<position>(loose, {});
+        reg.add<float>(loose, 0.f);
+        reg.add<int>(loose, 0);
+        reg.remove<int>(loose);
+        reg.each_hierarchical<float>([](const float& parent, float& child){ child = parent + 1; });
+        reg.each_hierarchical<position>([](const position&, position&){});
+        std::vector<trecs::entity_t> after = rows();
+        after.erase(std::find(after.begin(), after.end(), loose));
+        assert(after == sorted);
+        for(int i = 0; i < 64; i++) assert(reg.get<float>(nodes[i]) == float(reg.depth(nodes[i]) + 1));
+    }
+#endif
+
+#if __index_test
+    {
+        trecs::registry_t reg;
+        trecs::entity_t a = reg.create();
+        trecs::entity_t b = reg.create();
+        trecs::entity_t c = reg.create();
+        reg.add<int>(a, 7);
+
+        auto& byId = reg.index<int>([](const int& v){ return v; });
+        auto& byX = reg.ordered_index<position>([](const position& p){ return p.x; });
+        assert(byId.find(7) == a);
+
+        reg.add<int>(b, 9);
+        reg.add<int>(c, 9);
+        assert(byId.count(9) == 2 && byId.find_all(9).size() == 2);
+
+        reg.update<int>(b, 11);
+        assert(byId.find(11) == b && byId.find(9) == c);
+
+        reg.remove<int>(c);
+        assert(!byId.find(9) && byId.size() == 2);
+
+        reg.add<position>(a, {1, 0});
+        reg.add<position>(b, {5, 0});
+        reg.add<position>(c, {3, 0});
+        auto mid = byX.range(2.f, 6.f);
+        assert(mid.size() == 2 && mid[0] == c && mid[1] == b);
+
+        reg.destroy(b);
+        assert(!byId.find(11) && byX.range(2.f, 6.f).size() == 1);
+    }
+#endif
+
+#if __observer_test
+    {
+        trecs::registry_t reg;
+        size_t added = 0, updated = 0, removed = 0;
+        float removedX = 0;
+        reg.on_add<position>([&](const trecs::entity_batch_t& batch){ added += batch.size(); });
+        reg.on_update<position>([&](const trecs::entity_batch_t& batch){ updated += batch.size(); });
+        reg.on_remove<position>([&](const trecs::entity_batch_t& batch, std::vector<position>& comps){
+                removed += batch.size();
+                for(auto& p: comps) removedX += p.x;
+            });
+
+        trecs::entity_t a = reg.create();
+        trecs::entity_t b = reg.create();
+        reg.add<position>(a, {1, 0});
+        reg.add<position>(b, {2, 0});
+        reg.add<int>(a, 3);
+        assert(added == 0);
+
+        reg.flush_events();
+        assert(added == 2 && updated == 0 && removed == 0);
+
+        reg.update<position>(a, {4, 0});
+        reg.remove<position>(a);
+        reg.destroy(b);
+        reg.flush_events();
+        assert(added == 2 && updated == 1 && removed == 2 && removedX == 6.f);
+
+        reg.flush_events();
+        assert(added == 2 && updated == 1 && removed == 2);
+    }
+#endif
+
+#if __merge_test
+    {
+        trecs::registry_t world, section;
+        trecs::entity_t w = world.create();
+        world.add<int>(w, 1);
+        auto& byId = world.index<int>([](const int& v){ return v; });
+
+        trecs::entity_t s1 = section.create();
+        trecs::entity_t s2 = section.create();
+        trecs::entity_t s3 = section.create();
+        section.add<int>(s1, 10);
+        section.add<int>(s2, 20);
+        section.add<position>(s2, {2, 2});
+        section.add<float>(s3, 0.5f);
+        section.set_parent(s2, s1);
+
+        trecs::entity_map_t moved = world.move_entities(section, section.view<int>());
+        assert(moved.size() == 2);
+        assert(world.get<int>(moved[s1]) == 10 && world.get<int>(moved[s2]) == 20);
+        assert(world.get<position>(moved[s2]).x == 2.f);
+        assert(world.parent_of(moved[s2]) == moved[s1]);
+        assert(byId.find(20) == moved[s2]);
+        assert(section.has<float>(s3) && !section.has<int>(s1));
+
+        trecs::entity_map_t rest = world.merge(section);
+        assert(rest.size() == 1 && world.get<float>(rest[s3]) == 0.5f);
+        assert(!section.has<float>(s3));
+
+        trecs::entity_t x = world.create();
+        world.add<int>(x, 30);
+        assert(world.get<int>(moved[s2]) == 20 && world.get<int>(w) == 1);
+    }
+#endif
+
+#if __instantiate_test
+    {
+        trecs::registry_t reg;
+        size_t added = 0;
+        reg.on_add<int>([&](const trecs::entity_batch_t& batch){ added += batch.size(); });
+
+        trecs::entity_t proto = reg.create();
+        reg.add<int>(proto, 5);
+        reg.add<position>(proto, {1, 2});
+        trecs::entity_t gone = reg.create();
+        reg.destroy(gone);
+
+        trecs::entity_range_t spawned = reg.instantiate(proto, 1000);
+        assert(spawned.size() == 1000 && spawned[1] == spawned[0] + 1);
+        for(trecs::entity_t e: spawned){
+            assert(reg.get<int>(e) == 5 && reg.get<position>(e).y == 2.f);
+        }
+        reg.get<int>(spawned[10]) = 6;
+        assert(reg.get<int>(proto) == 5 && reg.get<int>(spawned[11]) == 5);
+
+        reg.flush_events();
+        assert(added == 1001);
+
+        trecs::entity_t e = reg.create();
+        reg.add<int>(e, 1);
+        reg.remove<int>(spawned[0]);
+        assert(reg.get<int>(spawned[999]) == 5 && reg.get<int>(e) == 1);
+
+        trecs::entity_range_t bare = reg.instantiate(reg.create(), 3);
+        assert(!reg.has<int>(bare[2]));
+    }
+#endif
+
+#if __dynamic_test
+    {
+        struct script_vel { float dx, dy; };
+        trecs::registry_t reg;
+        trecs::comp_id_t vel = reg.register_dynamic_component("script_vel", sizeof(script_vel), alignof(script_vel));
+        assert(reg.register_dynamic_component("script_vel", sizeof(script_vel), alignof(script_vel)) == vel);
+        const trecs::comp_id_t named = reg.register_dynamic_component(typeid(float).name(), sizeof(float), alignof(float));
+        assert(named != trecs::_get_comp_type_id<float>() && named != vel);
+
+        trecs::entity_t a = reg.create();
+        trecs::entity_t b = reg.create();
+        trecs::entity_t c = reg.create();
+        script_vel v{1, 2};
+        reg.add(a, vel, &v);
+        reg.add(b, vel);
+        reg.add<position>(a, {10, 10});
+        reg.add<position>(b, {20, 20});
+        reg.add<std::string>(c, "named");
+        assert(reg.has(a, vel) && !reg.has(c, vel));
+        assert(static_cast<script_vel*>(reg.get(b, vel))->dx == 0.f);
+
+        size_t rows = 0;
+        reg.view({trecs::_get_comp_type_id<position>(), vel}).forEach(
+                [&](void* const* columns, const trecs::entity_t*, size_t count){
+                    position* p = static_cast<position*>(columns[0]);
+                    script_vel* sv = static_cast<script_vel*>(columns[1]);
+                    for(size_t i = 0; i < count; i++){
+                        p[i].x += sv[i].dx;
+                        p[i].y += sv[i].dy;
+                    }
+                    rows += count;
+                });
+        assert(rows == 2);
+        assert(reg.get<position>(a).x == 11.f && reg.get<position>(a).y == 12.f);
+        assert(reg.get<position>(b).x == 20.f);
+
+        reg.remove(a, vel);
+        assert(!reg.has(a, vel) && reg.get<position>(a).x == 11.f);
+
+        reg.add<int>(c, 1);
+        reg.instantiate(c, 3);
+        reg.remove<int>(c);
+        assert(reg.get<std::string>(c) == "named");
+    }
+    {
+        // rows without a move op are relocated bitwise and destroyed exactly once
+        trecs::registry_t reg;
+        trecs::comp_ops_t ops;
+        ops.construct = [](void* dst){ *static_cast<int**>(dst) = new int(5); live_handles++; };
+        ops.destroy = [](void* ptr){ delete *static_cast<int**>(ptr); live_handles--; };
+        trecs::comp_id_t handle = reg.register_dynamic_component("script_handle", sizeof(int*), alignof(int*), ops);
+
+        trecs::entity_t a = reg.create();
+        trecs::entity_t b = reg.create();
+        reg.add(a, handle);
+        reg.add(b, handle);
+        reg.add<float>(a, 1.f);
+        reg.add<position>(a, {1, 0});
+        reg.add<position>(b, {1, 0});
+        reg.add<float>(b, 1.f);
+        assert(live_handles == 2 && **static_cast<int**>(reg.get(a, handle)) == 5);
+
+        reg.set_parent(a, b); // sorting moves b's row in front of a's
+        reg.each_hierarchical<position>([](const position& parent, position& child){ child.x += parent.x; });
+        assert(live_handles == 2 && **static_cast<int**>(reg.get(a, handle)) == 5);
+        assert(**static_cast<int**>(reg.get(b, handle)) == 5 && reg.get<position>(a).x == 2.f);
+
+        reg.remove<float>(a);
+        reg.destroy(b);
+        assert(live_handles == 1 && **static_cast<int**>(reg.get(a, handle)) == 5);
+        reg.remove(a, handle);
+        assert(live_handles == 0);
+    }
+#endif
+
+#if __wide_mask_test
+    {
+        trecs::registry_t reg;
+        trecs::entity_t a = reg.create();
+        trecs::entity_t b = reg.create();
+        add_tags(reg, a, std::make_integer_sequence<int, 80>{});
+        reg.add<tag<70>>(b, {});
+        reg.add<tag<3>>(b, {});
+        assert(trecs::_get_comp_type_id<tag<79>>() >= 64);
+        assert((reg.has<tag<0>, tag<64>, tag<79>>(a)));
+        assert(reg.get<tag<75>>(a).v == 75);
+
+        size_t n = 0;
+        reg.view<tag<70>, tag<3>>().forEach([&](tag<70>& t70, tag<3>& t3){
+                assert(t70.v == 70 && t3.v == 3);
+                n++;
+            });
+        assert(n == 2);
+
+        reg.remove<tag<70>>(a);
+        assert(!reg.has<tag<70>>(a) && reg.has<tag<71>>(a));
+    }
+#endif
+
+#if __accessor_test
+    {
+        trecs::registry_t reg;
+        std::vector<trecs::entity_t> targets;
+        for(int i = 0; i < 100; i++){
+            trecs::entity_t e = reg.create();
+            reg.add<int>(e, i);
+            if(i % 3 == 0) reg.add<position>(e, {float(i), 0});
+            targets.push_back(e);
+        }
+
+        auto acc = reg.accessor<int, position>();
+        assert(acc.get<int>(targets[42]) == 42);
+        assert(acc.get<position>(targets[9]).x == 9.f);
+        assert(!acc.try_get<position>(targets[10]));
+        acc.get<int>(targets[5]) = 500;
+        assert(reg.get<int>(targets[5]) == 500);
+
+        reg.add<float>(targets[42], 1.f);
+        reg.remove<position>(targets[9]);
+        assert(acc.get<int>(targets[42]) == 42 && !acc.try_get<position>(targets[9]));
+
+        std::vector<trecs::entity_t> query{targets[3], targets[4], targets[42], targets[99]};
+        std::vector<position*> out;
+        acc.get_many<position>(query, out);
+        assert(out.size() == 4 && out[0]->x == 3.f && !out[1] && out[3]->x == 99.f);
+    }
+#endif
+
+#if __double_buffer_test
+    {
+        trecs::registry_t reg;
+        trecs::entity_t a = reg.create();
+        trecs::entity_t b = reg.create();
+        reg.add<velocity>(a, {1, 0});
+        reg.add<velocity>(b, {2, 0});
+        reg.add<int>(a, 0);
+        assert(reg.get<velocity>(a).x == 1.f && reg.write<velocity>(a).x == 1.f);
+
+        reg.each_buffered<velocity>([](const velocity& front, velocity& back, trecs::entity_t){
+                back.x = front.x * 10;
+            });
+        assert(reg.get<velocity>(a).x == 1.f && reg.get<velocity>(b).x == 2.f);
+
+        reg.swap_buffers<velocity>();
+        assert(reg.get<velocity>(a).x == 10.f && reg.get<velocity>(b).x == 20.f);
+        assert(reg.write<velocity>(a).x == 1.f);
+
+        reg.write<velocity>(b).x = 7;
+        reg.add<float>(b, 1.f);
+        reg.remove<int>(a);
+        reg.instantiate(b, 2);
+        reg.swap_buffers<velocity>();
+        assert(reg.get<velocity>(b).x == 7.f && reg.write<velocity>(b).x == 20.f);
+        assert(reg.get<velocity>(a).x == 1.f);
+    }
+    {
+        // update goes to the back buffer, indexes and observers follow the swaps
+        trecs::registry_t reg;
+        trecs::entity_t e = reg.create();
+        reg.add<velocity>(e, {1, 0});
+        auto& idx = reg.index<velocity>([](const velocity& v){ return int(v.x); });
+        size_t updates = 0;
+        reg.on_update<velocity>([&](const trecs::entity_batch_t& batch){ updates += batch.size(); });
+
+        reg.update<velocity>(e, {7, 0});
+        assert(reg.get<velocity>(e).x == 1.f && reg.write<velocity>(e).x == 7.f);
+        assert(idx.find(1) == e && !idx.find(7));
+
+        reg.swap_buffers<velocity>();
+        assert(reg.get<velocity>(e).x == 7.f && idx.find(7) == e && !idx.find(1));
+
+        reg.write<velocity>(e).x = 5;
+        reg.swap_buffers<velocity>();
+        assert(idx.find(5) == e && !idx.find(7) && idx.size() == 1);
+        reg.flush_events();
+        assert(updates == 2);
+    }
+#endif
+
+#if __reserve_test
+    {
+        trecs::registry_t reg;
+        std::vector<trecs::entity_t> dead;
+        for(int i = 0; i < 100; i++) dead.push_back(reg.create());
+        for(int i = 0; i < 50; i++) reg.destroy(dead[i]);
+
+        std::vector<trecs::entity_t> out[4];
+        std::vector<std::thread> workers;
+        for(int t = 0; t < 4; t++){
+            workers.emplace_back([&reg, &out, t](){
+                    for(int i = 0; i < 100; i++) out[t].push_back(reg.reserve_entity());
+                    reg.reserve_entities(500, out[t]);
+                });
+        }
+        for(auto& w: workers) w.join();
+        reg.sync();
+
+        std::unordered_set<trecs::entity_t> ids;
+        size_t recycled = 0;
+        for(auto& o: out){
+            for(trecs::entity_t e: o){
+                ids.insert(e);
+                if(__entity_rc__(e)) recycled++;
+            }
+        }
+        assert(ids.size() == 2400 && recycled == 50);
+        for(trecs::entity_t e: ids){
+            reg.add<int>(e, 1);
+            assert(reg.get<int>(e) == 1);
+        }
+
+        trecs::entity_t fresh = reg.create();
+        assert(!ids.count(fresh) && !reg.has<int>(fresh));
+        reg.destroy(fresh);
+        assert(reg.create() == ((1u << 24) | __entity_id__(fresh)));
+    }
+    {
+        // registries can be built and handed around, pending reservations included
+        trecs::registry_t section;
+        trecs::entity_t a = section.create();
+        section.add<int>(a, 4);
+        section.set_parent(section.create(), a);
+        section.destroy(section.create());
+        trecs::entity_t pending = section.reserve_entity();
+        auto& idx = section.index<int>([](const int& v){ return v; });
+
+        trecs::registry_t moved(std::move(section));
+        moved.sync();
+        moved.add<int>(pending, 5);
+        assert(moved.get<int>(a) == 4 && moved.get<int>(pending) == 5 && idx.find(5) == pending);
+        assert(moved.first_child(a) && moved.memory_usage() > 0);
+        trecs::entity_t next = moved.create();
+        assert(next != pending && next != a && !moved.has<int>(next));
+    }
+#endif
+
+#if __memory_test
+    {
+        trecs::memory_budget_t engine;
+        trecs::registry_t reg(&engine, 4 << 20);
+        assert(reg.memory_usage() > 0 && engine.used() == reg.memory_usage());
+
+        trecs::entity_t proto = reg.create();
+        reg.add<position>(proto, {1, 1});
+        reg.add<int>(proto, 1);
+        trecs::entity_range_t batch = reg.instantiate(proto, 10000);
+        const size_t grown = reg.memory_usage();
+        assert(grown > 10000 * (sizeof(position) + sizeof(int)));
+
+        for(trecs::entity_t e: batch) reg.remove<int>(e);
+        for(trecs::entity_t e: batch) reg.add<int>(e, 2);
+        assert(reg.memory_usage() <= grown * 2 && reg.memory_peak() >= grown);
+
+        auto rows = [&](){
+            size_t n = 0;
+            reg.view<position, int>().forEach([&](position&, int&){ n++; });
+            return n;
+        };
+        const size_t before = rows();
+        for(size_t count: {size_t(1) << 20, size_t(150000), size_t(250000)}){
+            bool refused = false;
+            try {
+                reg.instantiate(proto, count);
+            } catch(const std::bad_alloc&){
+                refused = true;
+            }
+            assert(refused && reg.memory_usage() <= (4u << 20));
+            assert(rows() == before);
+        }
+        assert(reg.get<int>(batch[5]) == 2);
+
+        // the refused ids were never handed out, a new entity owns its own row
+        trecs::entity_t fresh = reg.create();
+        reg.add<position>(fresh, {3, 3});
+        reg.add<int>(fresh, 3);
+        assert(rows() == before + 1 && reg.get<int>(fresh) == 3 && reg.get<int>(batch[5]) == 2);
+    }
+    {
+        // refused add/remove/merge leave every entity whole
+        struct big { char bytes[256]; };
+        trecs::registry_t reg, other;
+        std::vector<trecs::entity_t> es;
+        for(int i = 0; i < 64; i++){
+            trecs::entity_t e = reg.create();
+            reg.add<int>(e, i);
+            reg.add<float>(e, 1.f);
+            es.push_back(e);
+        }
+        auto count = [](auto view){
+            size_t n = 0;
+            view.forEach([&](auto&...){ n++; });
+            return n;
+        };
+        auto consistent = [&](){
+            size_t withBig = 0;
+            for(size_t i = 0; i < es.size(); i++){
+                assert(reg.get<int>(es[i]) == int(i));
+                withBig += reg.has<big>(es[i]);
+            }
+            assert(count(reg.view<int>()) == es.size() && count(reg.view<big>()) == withBig);
+        };
+
+        reg.set_memory_cap(reg.memory_usage() + 1000);
+        size_t refused = 0;
+        for(trecs::entity_t e: es){
+            try { reg.add<big>(e, {}); } catch(const std::bad_alloc&){ refused++; }
+        }
+        assert(refused > 0);
+        consistent();
+
+        reg.set_memory_cap(SIZE_MAX);
+        for(trecs::entity_t e: es) reg.tryAdd<big>(e, {});
+        reg.set_memory_cap(0); // only blocks the pool already holds are left
+        refused = 0;
+        for(trecs::entity_t e: es){
+            try { reg.remove<float>(e); } catch(const std::bad_alloc&){ refused++; }
+        }
+        assert(refused > 0);
+        consistent();
+
+        for(int i = 0; i < 300; i++){
+            trecs::entity_t e = other.create();
+            other.add<int>(e, -1);
+            if(i % 2) other.add<float>(e, 1.f);
+        }
+        refused = 0;
+        try { reg.merge(other); } catch(const std::bad_alloc&){ refused++; }
+        assert(refused == 1);
+        consistent();
+        const size_t merged = count(reg.view<int>()) - es.size();
+        assert(merged + count(other.view<int>()) == 300);
+    }
+#endif
+
     return 0;
 }
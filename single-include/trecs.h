@@ -8,22 +8,33 @@
  * written for its usage in the game engine - Everest. It has efficient implementation
  * for adding, removing, quering or getting the components from entities. It uses
  * archetype graph method for organizing data neatly, so that there is no memory wastage
- * or leak. Entities recycling is also supported by the way. As of now it supports 64
- * different component types, which should be enough for any game engine.
+ * or leak. Entities recycling is also supported by the way. It supports TRECS_MAX_COMPONENTS
+ * (256 by default) different component types, define it before including to change it.
  */
 
 #pragma once
 
 
-#include <iostream>
 #include <inttypes.h>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <memory_resource>
+#include <cstring>
+#include <string>
+#include <typeinfo>
+#include <type_traits>
 #include <unordered_map>
+#include <iostream>
 #include <unordered_set>
 #include <vector>
-#include <any>
 #include <bitset>
-
 #include <functional>
+#include <memory>
+#include <map>
+#include <array>
+#include <atomic>
 
 #define TR_ASSERT
 
@@ -37,49 +48,552 @@
 #define __entity_id__(x) (x & 0x00ffffff)
 #define __entity_rc__(x) (x & 0xff000000)
 
+#if defined(__GNUC__) || defined(__clang__)
+#   define Prefetch(ptr) __builtin_prefetch(ptr)
+#else
+#   define Prefetch(ptr)
+#endif
+
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+#ifndef TRECS_MAX_COMPONENTS
+// maximum number of component types, can be raised before including trecs
+#   define TRECS_MAX_COMPONENTS 256
+#endif
+
+
 namespace trecs {
 
-    using entity_t = uint32_t;
-    using comp_id_t = uint64_t;
-    using archetype_id_t = uint64_t;
+    using comp_id_t = uint32_t;
 
-    using comprow_t = std::vector<std::any>;
-    using comptable_t = std::unordered_map<comp_id_t, comprow_t>;
+    /*
+     * Fixed width bitset of component ids, used as archetype id and for view matching.
+     * All operations work on whole words so that the compiler (or the SSE2 path) can
+     * process the mask as a few vector registers.
+     */
+    struct comp_mask_t {
+        static constexpr size_t words = (TRECS_MAX_COMPONENTS + 63) / 64;
+        alignas(16) uint64_t bits[words] = {};
 
-    struct archetype_t;
-    using archetype_edge_t = std::unordered_map<comp_id_t, archetype_t*>;
+        inline bool test(comp_id_t c) const {
+            return bits[c >> 6] & (1ull << (c & 63));
+        }
+        inline comp_mask_t& set(comp_id_t c){
+            bits[c >> 6] |= 1ull << (c & 63);
+            return *this;
+        }
+        inline comp_mask_t& reset(comp_id_t c){
+            bits[c >> 6] &= ~(1ull << (c & 63));
+            return *this;
+        }
+
+        inline comp_mask_t with(comp_id_t c) const {
+            comp_mask_t m = *this;
+            return m.set(c);
+        }
+        inline comp_mask_t without(comp_id_t c) const {
+            comp_mask_t m = *this;
+            return m.reset(c);
+        }
+
+        /*true if every bit of sub is also set here*/
+        inline bool contains(const comp_mask_t& sub) const {
+#if defined(__SSE2__)
+            if constexpr(words % 2 == 0){
+                __m128i miss = _mm_setzero_si128();
+                for(size_t i = 0; i < words; i += 2){
+                    __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(bits + i));
+                    __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(sub.bits + i));
+                    miss = _mm_or_si128(miss, _mm_andnot_si128(a, b));
+                }
+                return _mm_movemask_epi8(_mm_cmpeq_epi8(miss, _mm_setzero_si128())) == 0xffff;
+            }
+#endif
+            uint64_t miss = 0;
+            for(size_t i = 0; i < words; i++) miss |= sub.bits[i] & ~bits[i];
+            return !miss;
+        }
+
+        inline bool intersects(const comp_mask_t& other) const {
+            uint64_t hit = 0;
+            for(size_t i = 0; i < words; i++) hit |= bits[i] & other.bits[i];
+            return hit;
+        }
+
+        inline explicit operator bool() const {
+            uint64_t any = 0;
+            for(size_t i = 0; i < words; i++) any |= bits[i];
+            return any;
+        }
+
+        inline comp_mask_t operator|(const comp_mask_t& other) const {
+            comp_mask_t m;
+            for(size_t i = 0; i < words; i++) m.bits[i] = bits[i] | other.bits[i];
+            return m;
+        }
+        inline comp_mask_t operator&(const comp_mask_t& other) const {
+            comp_mask_t m;
+            for(size_t i = 0; i < words; i++) m.bits[i] = bits[i] & other.bits[i];
+            return m;
+        }
+        inline bool operator==(const comp_mask_t& other) const {
+            uint64_t diff = 0;
+            for(size_t i = 0; i < words; i++) diff |= bits[i] ^ other.bits[i];
+            return !diff;
+        }
+        inline bool operator!=(const comp_mask_t& other) const {
+            return !(*this == other);
+        }
+
+        /*calls fn with every set component id, in increasing order*/
+        template<typename F>
+        inline void for_each(F fn) const {
+            for(size_t i = 0; i < words; i++){
+                for(uint64_t w = bits[i]; w; w &= w-1){
+                    fn(static_cast<comp_id_t>(i * 64 + __builtin_ctzll(w)));
+                }
+            }
+        }
+
+        inline size_t hash() const {
+            uint64_t h = 0x9e3779b97f4a7c15ull;
+            for(size_t i = 0; i < words; i++){
+                h ^= bits[i];
+                h *= 0xff51afd7ed558ccdull;
+                h ^= h >> 32;
+            }
+            return static_cast<size_t>(h);
+        }
+    };
 
-    using entry_data_t = std::unordered_map<comp_id_t, std::any>;
-    struct entry_t {
-        entry_data_t entry;
-        entity_t updatedEntity = 0;
+    struct comp_mask_hash_t {
+        inline size_t operator()(const comp_mask_t& mask) const {
+            return mask.hash();
+        }
     };
 
 
+    /*
+     * Memory resource that forwards to upstream while keeping track of the bytes it handed out.
+     * Allocations that would go over the cap throw std::bad_alloc, as memory resources do.
+     */
+    struct memory_budget_t : std::pmr::memory_resource {
+        memory_budget_t(size_t cap_ = SIZE_MAX,
+                std::pmr::memory_resource* upstream_ = std::pmr::get_default_resource())
+            :_upstream(upstream_), _cap(cap_){}
+
+        inline size_t used() const {
+            return _used;
+        }
+
+        inline size_t peak() const {
+            return _peak;
+        }
+
+        inline size_t cap() const {
+            return _cap;
+        }
+
+        /*lowering the cap below the current usage only blocks further allocations*/
+        inline void set_cap(size_t cap_){
+            _cap = cap_;
+        }
+
+        protected:
+        inline void* do_allocate(size_t bytes, size_t alignment) override {
+            if(bytes > _cap - std::min(_used, _cap)) throw std::bad_alloc();
+            void* ptr = _upstream->allocate(bytes, alignment);
+            _used += bytes;
+            if(_used > _peak) _peak = _used;
+            return ptr;
+        }
+
+        inline void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+            _upstream->deallocate(ptr, bytes, alignment);
+            _used -= bytes;
+        }
+
+        inline bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+        private:
+        std::pmr::memory_resource* _upstream;
+        size_t _cap;
+        size_t _used = 0;
+        size_t _peak = 0;
+    };
+
+
+    using entity_t = uint32_t;
+    using archetype_id_t = comp_mask_t;
+
+    /*
+     * Lifetime operations of a component that is stored as raw bytes.
+     * A nullptr operation means the bytes can be handled directly: construct zero fills,
+     * copy and move are memcpy and destroy does nothing.
+     */
+    struct comp_ops_t {
+        void (*construct)(void* dst) = nullptr;
+        void (*copy)(void* dst, const void* src) = nullptr;
+        void (*move)(void* dst, void* src) = nullptr;
+        void (*destroy)(void* ptr) = nullptr;
+    };
+
+    struct comp_info_t {
+        std::string name;
+        size_t size = 0;
+        size_t align = 1;
+        comp_ops_t ops;
+        bool doubleBuffered = false;
+        bool zeroFill = true; // false if a row cannot be default constructed by zero filling it
+    };
+
+    /*
+     * Specialize to std::true_type before the component is first used to give its columns a
+     * front buffer, read through get/view, and a back buffer, written through write/each_buffered.
+     * registry_t::swap_buffers<T>() flips them.
+     */
+    template<typename T>
+    struct double_buffered_t : std::false_type {};
+
+    using comp_info_map_t = std::unordered_map<comp_id_t, comp_info_t>;
+
+    /*every component type ever registered, shared by all registries*/
+    inline comp_info_map_t& _comp_infos(){
+        static comp_info_map_t infos;
+        return infos;
+    }
+
+    /*ids of the components registered at runtime by name, kept apart from the C++ type names*/
+    inline std::unordered_map<std::string, comp_id_t>& _dynamic_comps(){
+        static std::unordered_map<std::string, comp_id_t> ids;
+        return ids;
+    }
+
+    inline const comp_info_t& _comp_info(comp_id_t id){
+        auto it = _comp_infos().find(id);
+        Assert(it != _comp_infos().end(), "Unknown component type");
+        return it->second;
+    }
+
     static uint32_t __comp_type_ctr__ = 0;
-    template<typename t>
+    inline comp_id_t _register_comp_type(comp_info_t info){
+        Assert(__comp_type_ctr__ < TRECS_MAX_COMPONENTS, "Ran out of component type ids, raise TRECS_MAX_COMPONENTS");
+        comp_id_t id = __comp_type_ctr__++;
+        _comp_infos().emplace(id, std::move(info));
+        return id;
+    }
+
+    template<typename T>
+    inline comp_info_t _make_comp_info(){
+        comp_info_t info{typeid(T).name(), sizeof(T), alignof(T), {}, double_buffered_t<T>::value};
+        if constexpr(std::is_default_constructible_v<T>){
+            info.ops.construct = [](void* dst){ new(dst) T(); };
+        }
+        info.zeroFill = std::is_trivially_default_constructible_v<T>;
+        if constexpr(!std::is_trivially_copyable_v<T>){
+            info.ops.copy = [](void* dst, const void* src){ new(dst) T(*static_cast<const T*>(src)); };
+            info.ops.move = [](void* dst, void* src){ new(dst) T(std::move(*static_cast<T*>(src))); };
+        }
+        if constexpr(!std::is_trivially_destructible_v<T>){
+            info.ops.destroy = [](void* ptr){ static_cast<T*>(ptr)->~T(); };
+        }
+        return info;
+    }
+
+    template<typename T>
     inline comp_id_t _get_comp_type_id(){
-        static comp_id_t id = 1ull << __comp_type_ctr__++;
+        static comp_id_t id = _register_comp_type(_make_comp_info<T>());
         return id;
     }
-// this macro is usable only inside templated methods, to make things easier... 
+// this macro is usable only inside templated methods, to make things easier...
 #define __ctype__ _get_comp_type_id<T>()
 
+    template<typename... T>
+    inline comp_mask_t _get_comp_mask(){
+        comp_mask_t mask;
+        (mask.set(_get_comp_type_id<T>()), ...);
+        return mask;
+    }
+
+
+    /*
+     * contiguous, type erased storage of one component type inside an archetype.
+     * Double buffered components keep a second buffer of the same layout, every row operation
+     * is applied to both so rows stay aligned
+     */
+    struct column_t {
+        const comp_info_t* info = nullptr;
+
+        column_t(const comp_info_t* info_ = nullptr,
+                std::pmr::memory_resource* resource_ = std::pmr::get_default_resource())
+            :info(info_), _resource(resource_){}
+        column_t(const column_t&) = delete;
+        column_t(column_t&& other) noexcept {
+            swap(other);
+        }
+        inline column_t& operator=(column_t&& other) noexcept {
+            swap(other);
+            return *this;
+        }
+        ~column_t(){
+            clear();
+            _free(_data, _capacity);
+            _free(_back, _capacity);
+        }
+
+        inline size_t size() const {
+            return _size;
+        }
+
+        inline void* data(){
+            return _data;
+        }
+
+        inline void* back_data(){
+            return _back;
+        }
+
+        inline void* at(size_t index){
+            Assert(index < _size, "Column index out of range");
+            return _data + index * info->size;
+        }
+
+        inline void* back_at(size_t index){
+            Assert(_back && index < _size, "Column index out of range or not double buffered");
+            return _back + index * info->size;
+        }
+
+        template<typename T>
+        inline T& get(size_t index){
+            return *static_cast<T*>(at(index));
+        }
+
+        /*both buffers are allocated before anything moves, a failed allocation changes nothing*/
+        inline void reserve(size_t capacity){
+            if(capacity <= _capacity) return;
+            uint8_t* data = _alloc(capacity);
+            uint8_t* back = nullptr;
+            if(_buffered()){
+                try {
+                    back = _alloc(capacity);
+                } catch(...){
+                    _resource->deallocate(data, capacity * info->size, info->align);
+                    throw;
+                }
+            }
+            _relocate_n(data, _data, _size);
+            _free(_data, _capacity);
+            if(back){
+                _relocate_n(back, _back, _size);
+                _free(_back, _capacity);
+            }
+            _data = data;
+            _back = back;
+            _capacity = capacity;
+        }
+
+        /*makes room for count more rows, at least doubling so repeated appends stay amortized*/
+        inline void reserve_more(size_t count){
+            if(_size + count <= _capacity) return;
+            reserve(std::max(_size + count, _capacity ? _capacity * 2 : 8));
+        }
+
+        template<typename T>
+        inline T* emplace(T&& value){
+            T* ptr = new(_push_uninit()) T(std::forward<T>(value));
+            _mirror_last();
+            return ptr;
+        }
+
+        inline void push_copy(const void* src){
+            void* dst = _push_uninit();
+            if(info->ops.copy) info->ops.copy(dst, src);
+            else std::memcpy(dst, src, info->size);
+            _mirror_last();
+        }
+
+        inline void push_default(){
+            Assert(info->ops.construct || info->zeroFill, "Component cannot be default constructed");
+            void* dst = _push_uninit();
+            if(info->ops.construct) info->ops.construct(dst);
+            else std::memset(dst, 0, info->size);
+            _mirror_last();
+        }
+
+        /*
+         * relocates row index of src, a column of the same component, to a new last row.
+         * The source row is left as raw bytes, drop it with src.swap_remove_relocated(index)
+         */
+        inline void push_row(column_t& src, size_t index){
+            void* dst = _push_uninit();
+            _relocate(dst, src.at(index));
+            if(_buffered()) _relocate(_back + (_size-1) * info->size, src.back_at(index));
+        }
+
+        /*destroys the row at index and moves the last row into its place*/
+        inline void swap_remove(size_t index){
+            Assert(index < _size, "Column index out of range");
+            _swap_remove(_data, index, true);
+            if(_buffered()) _swap_remove(_back, index, true);
+            _size--;
+        }
+
+        /*same as swap_remove for a row that push_row already relocated, it is not destroyed again*/
+        inline void swap_remove_relocated(size_t index){
+            Assert(index < _size, "Column index out of range");
+            _swap_remove(_data, index, false);
+            if(_buffered()) _swap_remove(_back, index, false);
+            _size--;
+        }
+
+        /*forgets every row without destroying them, for columns whose rows were all relocated*/
+        inline void drop_relocated(){
+            _size = 0;
+        }
+
+        /*moves all rows of src behind the rows of this column, src is left empty*/
+        inline void append_move(column_t& src){
+            if(!src._size) return;
+            if(!_size && _resource->is_equal(*src._resource)){
+                std::swap(_data, src._data);
+                std::swap(_back, src._back);
+                std::swap(_size, src._size);
+                std::swap(_capacity, src._capacity);
+                src.clear();
+                return;
+            }
+            reserve_more(src._size);
+            _relocate_n(_data + _size * info->size, src._data, src._size);
+            if(_buffered()) _relocate_n(_back + _size * info->size, src._back, src._size);
+            _size += src._size;
+            src._size = 0;
+        }
+
+        /*appends count copies of the row at index, both buffers get the front value*/
+        inline void append_copies(size_t index, size_t count){
+            reserve_more(count);
+            const void* src = at(index);
+            _copy_n(_data + _size * info->size, src, count);
+            if(_buffered()) _copy_n(_back + _size * info->size, src, count);
+            _size += count;
+        }
+
+        /*flips front and back buffers, no rows are copied*/
+        inline void swap_buffers(){
+            if(_buffered()) std::swap(_data, _back);
+        }
+
+        inline void clear(){
+            if(info && info->ops.destroy){
+                for(size_t i = 0; i < _size; i++) info->ops.destroy(_data + i * info->size);
+                if(_back) for(size_t i = 0; i < _size; i++) info->ops.destroy(_back + i * info->size);
+            }
+            _size = 0;
+        }
+
+        inline void swap(column_t& other) noexcept {
+            std::swap(info, other.info);
+            std::swap(_resource, other._resource);
+            std::swap(_data, other._data);
+            std::swap(_back, other._back);
+            std::swap(_size, other._size);
+            std::swap(_capacity, other._capacity);
+        }
+
+        private:
+        std::pmr::memory_resource* _resource = nullptr;
+        uint8_t* _data = nullptr;
+        uint8_t* _back = nullptr;
+        size_t _size = 0;
+        size_t _capacity = 0;
+
+        inline bool _buffered() const {
+            return info->doubleBuffered;
+        }
+
+        /*grows by one row and returns it unconstructed, the caller must construct it*/
+        inline void* _push_uninit(){
+            reserve_more(1);
+            return _data + _size++ * info->size;
+        }
+
+        /*copy constructs the back row of the last row from its front row*/
+        inline void _mirror_last(){
+            if(!_buffered()) return;
+            _copy_n(_back + (_size-1) * info->size, _data + (_size-1) * info->size, 1);
+        }
+
+        inline uint8_t* _alloc(size_t capacity){
+            return static_cast<uint8_t*>(_resource->allocate(capacity * info->size, info->align));
+        }
+
+        inline void _free(uint8_t* data, size_t capacity){
+            if(data) _resource->deallocate(data, capacity * info->size, info->align);
+        }
+
+        inline void _copy_n(uint8_t* dst, const void* src, size_t count){
+            if(!info->ops.copy){
+                for(size_t i = 0; i < count; i++) std::memcpy(dst + i * info->size, src, info->size);
+            } else {
+                for(size_t i = 0; i < count; i++) info->ops.copy(dst + i * info->size, src);
+            }
+        }
+
+        /*move constructs dst from src and destroys src*/
+        inline void _relocate(void* dst, void* src){
+            if(!info->ops.move){
+                std::memcpy(dst, src, info->size);
+                return;
+            }
+            info->ops.move(dst, src);
+            if(info->ops.destroy) info->ops.destroy(src);
+        }
+
+        inline void _relocate_n(uint8_t* dst, uint8_t* src, size_t count){
+            if(!count) return;
+            if(!info->ops.move) std::memcpy(dst, src, count * info->size);
+            else for(size_t i = 0; i < count; i++) _relocate(dst + i * info->size, src + i * info->size);
+        }
+
+        inline void _swap_remove(uint8_t* buffer, size_t index, bool destroy){
+            uint8_t* ptr = buffer + index * info->size;
+            if(destroy && info->ops.destroy) info->ops.destroy(ptr);
+            if(index != _size-1) _relocate(ptr, buffer + (_size-1) * info->size);
+        }
+    };
+
+
+    using comptable_t = std::pmr::unordered_map<comp_id_t, column_t>;
+
+    struct archetype_t;
+    using archetype_edge_t = std::pmr::unordered_map<comp_id_t, archetype_t*>;
+
 
     struct archetype_t {
         private:
-        std::vector<entity_t> _entities;
+        std::pmr::vector<entity_t> _entities;
         
         public:
-        archetype_id_t id = 0;
+        archetype_id_t id;
+        size_t serial = 0; // dense index of the archetype inside its registry
+        size_t version = 0; // bumped whenever rows are added, removed or reordered
         comptable_t table;
 
         archetype_edge_t plus;
         archetype_edge_t minus;
 
-        inline comprow_t& operator[](comp_id_t id){
+        archetype_t(archetype_id_t id_ = {}, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            :_entities(resource), id(id_), table(resource), plus(resource), minus(resource){
+            id.for_each([&](comp_id_t c_id){ table.try_emplace(c_id, &_comp_info(c_id), resource); });
+        }
+
+        inline column_t& operator[](comp_id_t id){
             Assert(table.find(id) != table.end(), "archetype doesnot have component");
-            return table[id];
+            return table.find(id)->second;
         }
 
         inline size_t size(){
@@ -90,9 +604,13 @@ namespace trecs {
              return _entities.at(index);
         }
 
+        inline const entity_t* entities() const {
+            return _entities.data();
+        }
+
         template<typename... T>
         inline std::tuple<T...> get(size_t index){
-            return std::make_tuple(std::any_cast<T>(table[__ctype__].at(index))...);
+            return std::make_tuple((*this)[__ctype__].template get<T>(index)...);
         }
 
         inline comptable_t::iterator begin(){
@@ -138,31 +656,454 @@ namespace trecs {
             return archetype;
         }
 
-        inline entry_t remove_entry(size_t index){
-            entry_t entr;
-            if(!_entities.size()) return entr;
-            for(auto& [c_id, vec]:table){
-                entr.entry[c_id] = std::move(vec[index]);
-                if(index != vec.size()-1){
-                    vec[index] = std::move(vec.back());
-                    if(!entr.updatedEntity){
-                        _entities[index] = _entities.back();
-                        entr.updatedEntity = _entities[index];
+        /*
+         * makes room for count more rows in every column and the entity list, growing
+         * geometrically; mutations reserve first so a refused allocation leaves the rows intact
+         */
+        inline void reserve_more(size_t count){
+            for(auto& [c_id, col]: table) col.reserve_more(count);
+            const size_t need = _entities.size() + count;
+            if(need > _entities.capacity()) _entities.reserve(std::max(need, 2 * _entities.capacity()));
+        }
+
+        /*
+         * moves the row at index to the end of dst, destroying the components dst does not have;
+         * columns only dst has are left one row short for the caller to push into.
+         * Returns the entity that was moved into index to fill the hole, 0 if none
+         */
+        inline entity_t move_entry(size_t index, archetype_t& dst, entity_t entity){
+            if(dst.id) dst.reserve_more(1); // may throw, nothing has moved yet
+            entity_t updatedEntity = 0;
+            if(_entities.size()){
+                for(auto& [c_id, col]: table){
+                    auto it = dst.table.find(c_id);
+                    if(it != dst.table.end()){
+                        it->second.push_row(col, index);
+                        col.swap_remove_relocated(index);
+                    } else {
+                        col.swap_remove(index);
                     }
                 }
-                vec.pop_back(); 
+                if(index != _entities.size()-1){
+                    _entities[index] = _entities.back();
+                    updatedEntity = _entities[index];
+                }
+                _entities.pop_back();
+            }
+            if(dst.id) dst._entities.push_back(entity); //root never holds rows
+            version++;
+            dst.version++;
+            return updatedEntity;
+        }
+
+        /*moves every row of src, an archetype with the same id, behind the rows of this one*/
+        inline size_t splice(archetype_t& src, const std::vector<entity_t>& entities){
+            Assert(src.id == id, "Cannot splice rows of a different archetype");
+            const size_t base = _entities.size();
+            reserve_more(src.size());
+            for(auto& [c_id, col]: src.table) table.find(c_id)->second.append_move(col);
+            _entities.insert(_entities.end(), entities.begin(), entities.end());
+            src._entities.clear();
+            version++;
+            src.version++;
+            return base;
+        }
+
+        /*appends count copies of the row at index, owned by the entities first, first+1, ...*/
+        inline size_t clone_rows(size_t index, size_t count, entity_t first){
+            const size_t base = _entities.size();
+            reserve_more(count);
+            for(auto& [c_id, col]: table) col.append_copies(index, count);
+            for(size_t i = 0; i < count; i++) _entities.push_back(first + i);
+            version++;
+            return base;
+        }
+
+        /*
+         * reorders the rows so that row i becomes the old row order[i]. Every buffer is
+         * allocated before any row moves, so a failed allocation leaves the archetype untouched
+         */
+        inline void permute(const std::vector<size_t>& order){
+            Assert(order.size() == _entities.size(), "Permutation does not cover every row");
+            std::pmr::vector<entity_t> entities(_entities.get_allocator());
+            entities.reserve(order.size());
+            std::vector<std::pair<column_t*, column_t>> fresh;
+            fresh.reserve(table.size());
+            for(auto& [c_id, col]: table){
+                fresh.emplace_back(&col, column_t(col.info, table.get_allocator().resource()));
+                fresh.back().second.reserve(order.size());
+            }
+
+            for(size_t i: order) entities.push_back(_entities[i]);
+            _entities.swap(entities);
+            for(auto& [col, dst]: fresh){
+                for(size_t i: order) dst.push_row(*col, i);
+                col->swap(dst);
+                dst.drop_relocated(); // only frees the old buffers, their rows live on in col
+            }
+            version++;
+        }
+    };
+
+
+    /*links of an entity inside the scene graph, indexed by entity id*/
+    struct hierarchy_node_t {
+        entity_t parent = 0;
+        entity_t firstChild = 0;
+        entity_t nextSibling = 0;
+        entity_t prevSibling = 0;
+        uint32_t depth = 0;
+        size_t slot = 0; // position inside its level bucket
+        bool linked = false; // true if the entity has a parent or any child
+    };
+
+    using hierarchy_nodes_t = std::vector<hierarchy_node_t>;
+    using hierarchy_level_t = std::vector<entity_t>;
+
+    struct hierarchy_parent_t {
+        archetype_t* arch = nullptr;
+        size_t index = 0;
+    };
+
+    /*
+     * rows of one archetype sorted for hierarchical traversal: rows [starts[d], starts[d+1])
+     * hold the entities at depth d, grouped by parent, rows past starts.back() are not linked.
+     * parents[i - starts[1]] is where the parent of row i lives, deps are the archetypes those
+     * parents are in along with the version they were looked up at
+     */
+    struct hierarchy_span_t {
+        archetype_t* arch = nullptr;
+        size_t version = SIZE_MAX; // arch->version the layout was computed at
+        size_t hierarchy = SIZE_MAX; // hierarchy version the layout was computed at
+        std::vector<size_t> levelVersions; // hierarchy levelVersions the layout was computed at
+        std::vector<size_t> starts;
+        std::vector<hierarchy_parent_t> parents;
+        std::vector<std::pair<archetype_t*, size_t>> deps;
+    };
+
+    /*sorted layout of every archetype holding a component, archetypes counts those seen so far*/
+    struct hierarchy_order_t {
+        size_t archetypes = 0;
+        std::vector<hierarchy_span_t> spans;
+    };
+
+    using hierarchy_orders_t = std::unordered_map<comp_id_t, hierarchy_order_t>;
+
+    /*
+     * Keeps parent/first-child/sibling links and buckets every linked entity by its depth,
+     * so that walking the levels in order visits each parent before any of its children.
+     * Reparenting only touches the moved subtree.
+     */
+    struct hierarchy_t {
+        std::vector<hierarchy_level_t> levels;
+        std::vector<size_t> levelVersions; // version of the last change inside each level
+        size_t version = 0; // bumped on every change of links or depths
+
+        inline bool linked(entity_t entity) const {
+            const entity_t ind = __entity_id__(entity);
+            return ind < _nodes.size() && _nodes[ind].linked;
+        }
+
+        inline const hierarchy_node_t& node(entity_t entity){
+            return _node(entity);
+        }
+
+        inline void attach(entity_t child, entity_t parent){
+            Assert(__entity_id__(child) != __entity_id__(parent), "Entity cannot be its own parent");
+            for(entity_t a = parent; a; a = _node(a).parent){
+                Assert(__entity_id__(a) != __entity_id__(child), "Reparenting would create a cycle");
+            }
+            version++;
+            _unlink_parent(child);
+
+            hierarchy_node_t& pn = _node(parent);
+            if(!pn.linked) _insert_level(parent, 0);
+
+            hierarchy_node_t& cn = _node(child);
+            cn.parent = parent;
+            cn.prevSibling = 0;
+            cn.nextSibling = pn.firstChild;
+            if(pn.firstChild) _node(pn.firstChild).prevSibling = child;
+            pn.firstChild = child;
+
+            _relevel(child);
+            levelVersions[_node(child).depth] = version; // its parent changed even if its depth did not
+        }
+
+        inline void detach(entity_t child){
+            if(!linked(child) || !_node(child).parent) return;
+            version++;
+            _unlink_parent(child);
+            if(_node(child).firstChild) _relevel(child);
+            else _erase_level(child);
+        }
+
+        /*removes entity from the graph, its children become roots*/
+        inline void erase(entity_t entity){
+            if(!linked(entity)) return;
+            version++;
+            _unlink_parent(entity);
+            entity_t c = _node(entity).firstChild;
+            while(c){
+                hierarchy_node_t& cn = _node(c);
+                entity_t next = cn.nextSibling;
+                cn.parent = cn.prevSibling = cn.nextSibling = 0;
+                if(cn.firstChild) _relevel(c);
+                else _erase_level(c);
+                c = next;
+            }
+            _node(entity).firstChild = 0;
+            _erase_level(entity);
+        }
+
+        private:
+        hierarchy_nodes_t _nodes;
+
+        inline hierarchy_node_t& _node(entity_t entity){
+            const entity_t ind = __entity_id__(entity);
+            if(ind >= _nodes.size()) _nodes.resize(ind+1);
+            return _nodes[ind];
+        }
+
+        /*cuts the entity out of its parent's child list, leaves its own subtree intact*/
+        inline void _unlink_parent(entity_t entity){
+            hierarchy_node_t& n = _node(entity);
+            if(!n.parent) return;
+            entity_t parent = n.parent;
+            if(n.prevSibling) _node(n.prevSibling).nextSibling = n.nextSibling;
+            else _node(parent).firstChild = n.nextSibling;
+            if(n.nextSibling) _node(n.nextSibling).prevSibling = n.prevSibling;
+            n.parent = n.prevSibling = n.nextSibling = 0;
+
+            hierarchy_node_t& pn = _node(parent);
+            if(!pn.firstChild && !pn.parent) _erase_level(parent);
+        }
+
+        inline void _insert_level(entity_t entity, uint32_t depth){
+            if(levels.size() <= depth){
+                levels.resize(depth+1);
+                levelVersions.resize(depth+1);
+            }
+            levelVersions[depth] = version;
+            hierarchy_node_t& n = _node(entity);
+            n.depth = depth;
+            n.slot = levels[depth].size();
+            n.linked = true;
+            levels[depth].push_back(entity);
+        }
+
+        inline void _erase_level(entity_t entity){
+            hierarchy_node_t& n = _node(entity);
+            if(!n.linked) return;
+            hierarchy_level_t& bucket = levels[n.depth];
+            levelVersions[n.depth] = version;
+            entity_t last = bucket.back();
+            bucket[n.slot] = last;
+            _node(last).slot = n.slot;
+            bucket.pop_back();
+            n.linked = false;
+        }
+
+        /*recomputes depth of the subtree rooted at entity from its (new) parent*/
+        inline void _relevel(entity_t entity){
+            std::vector<entity_t> stack{entity};
+            while(!stack.empty()){
+                entity_t e = stack.back();
+                stack.pop_back();
+                hierarchy_node_t& n = _node(e);
+                uint32_t depth = n.parent ? _node(n.parent).depth + 1 : 0;
+                if(!n.linked || n.depth != depth){
+                    _erase_level(e);
+                    _insert_level(e, depth);
+                }
+                for(entity_t c = _node(e).firstChild; c; c = _node(c).nextSibling){
+                    stack.push_back(c);
+                }
+            }
+        }
+    };
+
+
+    /*type erased hook, the registry calls it on every mutation of the indexed component*/
+    struct index_base_t {
+        virtual ~index_base_t() = default;
+        virtual void set(entity_t entity, const void* comp) = 0;
+        virtual void erase(entity_t entity) = 0;
+    };
+
+    using index_list_t = std::vector<std::unique_ptr<index_base_t>>;
+    using index_map_t = std::unordered_map<comp_id_t, index_list_t>;
+
+    /*
+     * Secondary index from a key computed out of component T to the entities holding it.
+     * Map is a multimap type, hashed (O(1) lookup) or ordered (O(log n) lookup and ranges).
+     * Only mutations done through the registry are tracked, so values edited in place through
+     * get() or a view must be written back with update() to stay indexed.
+     */
+    template<typename T, typename K, typename Map>
+    struct index_t : index_base_t {
+        using key_t = K;
+        using key_fn_t = std::function<K(const T&)>;
+        using iterator = typename Map::const_iterator;
+
+        index_t(key_fn_t key_fn):_key_fn(std::move(key_fn)){}
+
+        inline void set(entity_t entity, const void* comp) override {
+            K key = _key_fn(*static_cast<const T*>(comp));
+            auto it = _keys.find(entity);
+            if(it != _keys.end()){
+                if(it->second == key) return;
+                _erase_entry(it->second, entity);
+                it->second = key;
+            } else {
+                _keys.emplace(entity, key);
+            }
+            _map.emplace(std::move(key), entity);
+        }
+
+        inline void erase(entity_t entity) override {
+            auto it = _keys.find(entity);
+            if(it == _keys.end()) return;
+            _erase_entry(it->second, entity);
+            _keys.erase(it);
+        }
+
+        /*returns any entity with the key, 0 if there is none*/
+        inline entity_t find(const K& key) const {
+            auto it = _map.find(key);
+            return it == _map.end() ? 0 : it->second;
+        }
+
+        inline std::vector<entity_t> find_all(const K& key) const {
+            std::vector<entity_t> out;
+            auto [b, e] = _map.equal_range(key);
+            for(; b != e; ++b) out.push_back(b->second);
+            return out;
+        }
+
+        inline size_t count(const K& key) const {
+            return _map.count(key);
+        }
+
+        /*entities with keys in [lo, hi), only available on ordered indexes*/
+        inline std::vector<entity_t> range(const K& lo, const K& hi) const {
+            std::vector<entity_t> out;
+            for(auto it = _map.lower_bound(lo), e = _map.lower_bound(hi); it != e; ++it){
+                out.push_back(it->second);
+            }
+            return out;
+        }
+
+        inline size_t size() const {
+            return _keys.size();
+        }
+
+        inline iterator begin() const {
+            return _map.cbegin();
+        }
+        inline iterator end() const {
+            return _map.cend();
+        }
+
+        private:
+        key_fn_t _key_fn;
+        Map _map;
+        std::unordered_map<entity_t, K> _keys;
+
+        inline void _erase_entry(const K& key, entity_t entity){
+            auto [b, e] = _map.equal_range(key);
+            for(; b != e; ++b){
+                if(b->second == entity){
+                    _map.erase(b);
+                    return;
+                }
             }
-            _entities.pop_back();
-            return entr;
         }
+    };
+
+    template<typename T, typename K>
+    using hash_index_t = index_t<T, K, std::unordered_multimap<K, entity_t>>;
+
+    template<typename T, typename K>
+    using ordered_index_t = index_t<T, K, std::multimap<K, entity_t>>;
+
+    template<typename T, typename F>
+    using index_key_t = std::decay_t<std::invoke_result_t<F, const T&>>;
+
+
+    using entity_batch_t = std::vector<entity_t>;
+
+    /*type erased event buffer of a single component type*/
+    struct observer_base_t {
+        virtual ~observer_base_t() = default;
+        virtual void push_added(entity_t entity) = 0;
+        virtual void push_updated(entity_t entity) = 0;
+        virtual void push_removed(entity_t entity, void* comp) = 0;
+        virtual void flush() = 0;
+    };
+
+    using observer_map_t = std::unordered_map<comp_id_t, std::unique_ptr<observer_base_t>>;
+
+    /*
+     * Buffers the lifecycle events of component T until flush, then hands each handler the
+     * whole batch at once. Removed components are moved into the buffer along with their
+     * entities, so on_remove handlers can still release what the component owned.
+     * Events of a batch may be stale: an added entity can lose T again before the flush.
+     */
+    template<typename T>
+    struct observer_t : observer_base_t {
+        using batch_fn_t = std::function<void(const entity_batch_t&)>;
+        using remove_fn_t = std::function<void(const entity_batch_t&, std::vector<T>&)>;
+
+        std::vector<batch_fn_t> addHandlers;
+        std::vector<batch_fn_t> updateHandlers;
+        std::vector<remove_fn_t> removeHandlers;
+
+        inline void push_added(entity_t entity) override {
+            _added.push_back(entity);
+        }
+
+        inline void push_updated(entity_t entity) override {
+            _updated.push_back(entity);
+        }
+
+        inline void push_removed(entity_t entity, void* comp) override {
+            _removed.push_back(entity);
+            _removedComps.push_back(std::move(*static_cast<T*>(comp)));
+        }
+
+        /*handlers may touch the registry, events they raise go to the next flush*/
+        inline void flush() override {
+            _deliver(_added, addHandlers);
+            _deliver(_updated, updateHandlers);
 
-        inline size_t add_entry(entry_t& entry){
-            if(entry.entry.begin() == entry.entry.end()) return 0; //special case
-            for(auto& [c_id, comp]: entry.entry){
-                table[c_id].push_back(comp);
+            if(_removed.empty()) return;
+            entity_batch_t batch;
+            std::vector<T> comps;
+            batch.swap(_removed);
+            comps.swap(_removedComps);
+            for(auto& fn: removeHandlers) fn(batch, comps);
+            batch.clear();
+            comps.clear();
+            if(_removed.empty()){
+                _removed.swap(batch);
+                _removedComps.swap(comps);
             }
-            _entities.push_back(entry.updatedEntity);
-            return _entities.size()-1;
+        }
+
+        private:
+        entity_batch_t _added;
+        entity_batch_t _updated;
+        entity_batch_t _removed;
+        std::vector<T> _removedComps;
+
+        inline void _deliver(entity_batch_t& events, std::vector<batch_fn_t>& handlers){
+            if(events.empty()) return;
+            entity_batch_t batch;
+            batch.swap(events);
+            for(auto& fn: handlers) fn(batch);
+            batch.clear();
+            if(events.empty()) events.swap(batch); // keep the capacity for the next frame
         }
     };
 
@@ -174,24 +1115,43 @@ namespace trecs {
     };
 
     using view_id_t = archetype_id_t;
-    using archetype_map_t = std::unordered_map<archetype_id_t, archetype_t>;
-    using entity_records_t = std::vector<record_t>;
-    using recycleReg_t = std::vector<entity_t>;
+    using archetype_map_t = std::pmr::unordered_map<archetype_id_t, archetype_t, comp_mask_hash_t>;
+    using entity_records_t = std::pmr::vector<record_t>;
+    using recycleReg_t = std::pmr::vector<entity_t>;
+    using entity_map_t = std::unordered_map<entity_t, entity_t>;
+
+    /*entities with consecutive ids, as returned by registry_t::instantiate*/
+    struct entity_range_t {
+        entity_t first = 0;
+        size_t count = 0;
+
+        struct iterator {
+            entity_t entity;
+            inline entity_t operator*() const { return entity; }
+            inline iterator& operator++(){ ++entity; return *this; }
+            inline bool operator!=(const iterator& other) const { return entity != other.entity; }
+        };
+
+        inline size_t size() const { return count; }
+        inline entity_t operator[](size_t i) const { return first + i; }
+        inline iterator begin() const { return {first}; }
+        inline iterator end() const { return {static_cast<entity_t>(first + count)}; }
+    };
 
     template<typename... T>
     struct view_t {
-        view_id_t id = 0;
+        view_id_t id;
 
         inline void forEach(const std::function<void(T&...)>& callback){
             size_t i = 0;
             archetype_map_t::iterator _cur_arch = _archmap.begin();
             archetype_map_t::iterator _end_arch = _archmap.end();
             while(1){
-                while(i >= _cur_arch->second.size() || (_cur_arch->first & id) != id){
+                while(i >= _cur_arch->second.size() || !_cur_arch->first.contains(id)){
                     if(++_cur_arch == _end_arch) return;
                     i = 0;
                 }
-                callback(std::any_cast<T&>(_cur_arch->second[__ctype__].at(i)) ...);
+                callback(_cur_arch->second[__ctype__].template get<T>(i) ...);
                 i++;
             }
         }
@@ -201,11 +1161,11 @@ namespace trecs {
             archetype_map_t::iterator _cur_arch = _archmap.begin();
             archetype_map_t::iterator _end_arch = _archmap.end();
             while(1){
-                while(i >= _cur_arch->second.size() || (_cur_arch->first & id) != id){
+                while(i >= _cur_arch->second.size() || !_cur_arch->first.contains(id)){
                     if(++_cur_arch == _end_arch) return;
                     i = 0;
                 }
-                callback(std::any_cast<T&>(_cur_arch->second[__ctype__].at(i)) ...,
+                callback(_cur_arch->second[__ctype__].template get<T>(i) ...,
                         _cur_arch->second.entityAt(i));
                 i++;
             }
@@ -218,38 +1178,262 @@ namespace trecs {
         view_t(view_id_t id_, archetype_map_t& arch_):id(id_), _archmap(arch_){}
     };
 
+    /*
+     * Random access to the components T... of arbitrary entities. Column pointers are cached per
+     * archetype, so a lookup is one record load and an indexed read, with no hashing.
+     * The accessor stays valid across structural changes of the registry.
+     */
+    template<typename... T>
+    struct accessor_t {
+        template<typename U>
+        inline U& get(const entity_t entity){
+            const record_t& rec = _records[__entity_id__(entity)];
+            column_t* col = _columns(rec.archeType)[_slot<U>()];
+            Assert(col, "Entity does not have the component");
+            return static_cast<U*>(col->data())[rec.index];
+        }
+
+        /*returns nullptr instead of asserting when the entity lacks U*/
+        template<typename U>
+        inline U* try_get(const entity_t entity){
+            const record_t& rec = _records[__entity_id__(entity)];
+            column_t* col = _columns(rec.archeType)[_slot<U>()];
+            return col ? static_cast<U*>(col->data()) + rec.index : nullptr;
+        }
+
+        /*
+         * resolves U of every entity into out (nullptr for entities without U), in input order.
+         * Records are prefetched a few entities ahead and runs of entities sharing an archetype
+         * reuse the resolved column
+         */
+        template<typename U>
+        inline void get_many(const std::vector<entity_t>& entities, std::vector<U*>& out){
+            constexpr size_t ahead = 8;
+            const size_t n = entities.size();
+            out.resize(n);
+            for(size_t i = 0; i < n && i < ahead; i++) Prefetch(&_records[__entity_id__(entities[i])]);
+
+            archetype_t* arch = nullptr;
+            U* base = nullptr;
+            for(size_t i = 0; i < n; i++){
+                if(i + ahead < n) Prefetch(&_records[__entity_id__(entities[i + ahead])]);
+                const record_t& rec = _records[__entity_id__(entities[i])];
+                if(rec.archeType != arch){
+                    arch = rec.archeType;
+                    column_t* col = _columns(arch)[_slot<U>()];
+                    base = col ? static_cast<U*>(col->data()) : nullptr;
+                }
+                out[i] = base ? base + rec.index : nullptr;
+                if(base) Prefetch(out[i]);
+            }
+        }
+
+        private:
+        using columns_t = std::array<column_t*, sizeof...(T)>;
+
+        entity_records_t& _records;
+        std::vector<columns_t> _cache;
+        std::vector<bool> _cached;
+        friend class registry_t;
+
+        accessor_t(entity_records_t& records_):_records(records_){}
+
+        template<typename U>
+        static constexpr size_t _slot(){
+            constexpr bool match[] = {std::is_same_v<U, T>...};
+            size_t i = 0;
+            while(i < sizeof...(T) && !match[i]) i++;
+            static_assert((std::is_same_v<U, T> || ...), "Component is not part of the accessor");
+            return i;
+        }
+
+        inline columns_t& _columns(archetype_t* arch){
+            if(arch->serial >= _cache.size()){
+                _cache.resize(arch->serial + 1);
+                _cached.resize(arch->serial + 1);
+            }
+            columns_t& cols = _cache[arch->serial];
+            if(!_cached[arch->serial]){
+                cols = {(arch->id.test(_get_comp_type_id<T>()) ? &(*arch)[_get_comp_type_id<T>()] : nullptr)...};
+                _cached[arch->serial] = true;
+            }
+            return cols;
+        }
+    };
+
+    /*view over components known only by id, e.g. ones registered at runtime by scripts*/
+    struct raw_view_t {
+        view_id_t id;
+
+        /*columns holds one pointer per requested component, in request order, each `count` rows long*/
+        using chunk_fn_t = std::function<void(void* const* columns, const entity_t* entities, size_t count)>;
+
+        /*calls back once per matching archetype with its raw columns*/
+        inline void forEach(const chunk_fn_t& callback){
+            std::vector<void*> columns(_comps.size());
+            for(auto& [a_id, arch]: _archmap){
+                if(!arch.size() || !a_id.contains(id)) continue;
+                for(size_t c = 0; c < _comps.size(); c++) columns[c] = arch[_comps[c]].data();
+                callback(columns.data(), arch.entities(), arch.size());
+            }
+        }
+
+        private:
+        archetype_map_t& _archmap;
+        std::vector<comp_id_t> _comps;
+        friend class registry_t;
+
+        raw_view_t(const std::vector<comp_id_t>& comps, archetype_map_t& arch_):_archmap(arch_), _comps(comps){
+            for(comp_id_t c: comps) id.set(c);
+        }
+    };
+
     class registry_t {
         public:
-            registry_t(){
-                _archetypeStore[0] = {/*root*/};
+            /*
+             * All archetype storage (columns, entity lists, the archetype store, records and
+             * the recycle register)
+             * comes from a size-class pool owned by the registry, which draws from upstream
+             * through a budget of memoryCap bytes. Going over the cap throws std::bad_alloc; every
+             * mutation reserves before it moves rows, so a refused entity stays as it was
+             * (a refused merge may have moved some archetypes already)
+             */
+            registry_t(std::pmr::memory_resource* upstream = std::pmr::get_default_resource(),
+                    size_t memoryCap = SIZE_MAX)
+                :_budget(std::make_unique<memory_budget_t>(memoryCap, upstream)),
+                _pool(std::make_unique<std::pmr::unsynchronized_pool_resource>(_budget.get())),
+                _records(_pool.get()), _archetypeStore(_pool.get()), _recycleReg(_pool.get()){
+                _root = &_archetypeStore.try_emplace(archetype_id_t{}, archetype_id_t{}, _pool.get()).first->second;
                 _records.push_back({}); // leave first slot empty, entity 0 never exists
             }
 
+            /*
+             * takes over the storage of other, which may only be destroyed afterwards. Archetypes,
+             * indexes and observers stay where they are; views and accessors of other do not
+             * follow, fetch new ones. Must not run concurrently with reserve_entity on other
+             */
+            registry_t(registry_t&& other)
+                :_budget(std::move(other._budget)), _pool(std::move(other._pool)),
+                _records(std::move(other._records)), _archetypeStore(std::move(other._archetypeStore)),
+                _root(other._root), _recycleReg(std::move(other._recycleReg)),
+                _hierarchy(std::move(other._hierarchy)), _hierarchyOrders(std::move(other._hierarchyOrders)),
+                _placed(std::move(other._placed)), _indexes(std::move(other._indexes)),
+                _indexedMask(other._indexedMask), _observers(std::move(other._observers)),
+                _addObserved(other._addObserved), _updateObserved(other._updateObserved),
+                _removeObserved(other._removeObserved),
+                __entity_generator(other.__entity_generator.load(std::memory_order_relaxed)),
+                _recycleTaken(other._recycleTaken.load(std::memory_order_relaxed)){
+                other._root = nullptr;
+            }
+
+            registry_t& operator=(registry_t&&) = delete;
+
+            /*Memory Ops*/
+            /*bytes the registry's storage currently holds from upstream, pooled free blocks included*/
+            inline size_t memory_usage() const {
+                return _budget->used();
+            }
+
+            inline size_t memory_peak() const {
+                return _budget->peak();
+            }
+
+            inline void set_memory_cap(size_t bytes){
+                _budget->set_cap(bytes);
+            }
+
             /*Entity Ops*/
 
             /*creates an entity*/
             inline entity_t create(){
-                while(!_recycleReg.empty()){
-                    int en = _recycleReg.back();
+                sync();
+                if(!_recycleReg.empty()){
+                    entity_t en = _recycleReg.back();
                     _recycleReg.pop_back();
-                    int rc = __entity_rc__(en);
-                    if(rc < 0xff){
-                        return ((rc+1)<<24) | __entity_id__(en);
-                    }
+                    return _next_generation(en);
                 }
 
-                _records.push_back(record_t{&_archetypeStore[0], 0});
+                _records.push_back(record_t{_root, 0});
                 return ++__entity_generator;
             }
 
+            /*
+             * hands out a valid entity id without touching the records, so it may be called from
+             * many threads at once, as long as no other registry op runs meanwhile.
+             * The entity becomes usable after the next sync() (create/destroy sync as well)
+             */
+            inline entity_t reserve_entity(){
+                const size_t k = _recycleTaken.fetch_add(1, std::memory_order_relaxed);
+                if(k < _recycleReg.size()) return _next_generation(_recycleReg[_recycleReg.size()-1-k]);
+                return __entity_generator.fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+
+            /*same as reserve_entity, but touches each shared counter once for the whole batch*/
+            inline void reserve_entities(size_t count, std::vector<entity_t>& out){
+                const size_t k = _recycleTaken.fetch_add(count, std::memory_order_relaxed);
+                const size_t avail = _recycleReg.size();
+                size_t i = 0;
+                for(; i < count && k+i < avail; i++) out.push_back(_next_generation(_recycleReg[avail-1-k-i]));
+                if(i == count) return;
+                const entity_t first = __entity_generator.fetch_add(count-i, std::memory_order_relaxed) + 1;
+                for(entity_t e = first; i < count; i++, e++) out.push_back(e);
+            }
+
+            /*materializes the records of the entities handed out by reserve_entity*/
+            inline void sync(){
+                if(size_t taken = _recycleTaken.load(std::memory_order_relaxed)){
+                    _recycleReg.resize(_recycleReg.size() - std::min(taken, _recycleReg.size()));
+                    _recycleTaken.store(0, std::memory_order_relaxed);
+                }
+                if(_records.size() <= __entity_generator){
+                    _records.resize(__entity_generator + 1, record_t{_root, 0});
+                }
+            }
+
+            /*
+             * creates count copies of prototype with all of its components, the rows are copied
+             * into the prototype's archetype in bulk. Ids are always fresh (never recycled) so the
+             * result is one consecutive range; hierarchy links are not copied
+             */
+            inline entity_range_t instantiate(const entity_t prototype, size_t count){
+                sync();
+                const entity_t ind = __entity_id__(prototype);
+                Assert(ind < _records.size(), "Invalid entity");
+                const record_t proto = _records[ind];
+                entity_range_t range{__entity_generator + 1, count};
+                if(!count) return range;
+
+                // reserved before any row is cloned, a refused allocation leaves the registry as it was
+                _reserve_more(_records, count);
+                archetype_t* arch = proto.archeType;
+                const size_t base = arch->id ? arch->clone_rows(proto.index, count, range.first) : 0;
+                for(size_t i = 0; i < count; i++){
+                    _records.push_back(record_t{arch, arch->id ? base+i : 0});
+                }
+                __entity_generator += count;
+                if(arch->id.intersects(_indexedMask | _addObserved)) _notify_appended(*arch, base);
+                return range;
+            }
+
             inline void destroy(entity_t entity){
-                Assert(__entity_id__(entity) <= _records.size(), "Invalid entity");
+                sync();
+                Assert(__entity_id__(entity) < _records.size(), "Invalid entity");
                 const entity_t ind = __entity_id__(entity);
                 record_t& rec = _records[ind];
-                auto en = rec.archeType->remove_entry(rec.index);
-                if(en.updatedEntity) _records[__entity_id__(en.updatedEntity)].index = rec.index;
-                rec.archeType = &_archetypeStore[0];
-                _recycleReg.push_back(entity);
+                archetype_t* arch = rec.archeType;
+                _reserve_more(_recycleReg, 1);
+                if(arch->id.intersects(_indexedMask)) _index_erase(arch->id, entity);
+                if(arch->id.intersects(_removeObserved)){
+                    for(auto& [c_id, col]: *arch){
+                        if(_removeObserved.test(c_id)) _observers[c_id]->push_removed(entity, col.at(rec.index));
+                    }
+                }
+                entity_t updated = arch->move_entry(rec.index, *_root, entity);
+                if(updated) _records[__entity_id__(updated)].index = rec.index;
+                rec.archeType = _root;
+                rec.index = 0;
+                _hierarchy.erase(entity);
+                _release(entity);
             }
 
             /*Component Ops*/
@@ -267,35 +1451,30 @@ namespace trecs {
                 else add<T>(entity, data);
             }
 
+            /*
+             * double buffered components are written to the back buffer, readers see the value
+             * (and indexes and on_update get it) after the next swap_buffers<T>()
+             */
             template<typename T>
             inline void update(const entity_t entity, T data){
                 const entity_t ind = __entity_id__(entity);
                 Assert(ind < _records.size(), "Invalid entity");
                 record_t& rec = _records[ind];
-                Assert(rec.archeType->id & __ctype__, "Entity does not have the component to update");
-                (*rec.archeType)[__ctype__][rec.index] = data;
+                Assert(rec.archeType->id.test(__ctype__), "Entity does not have the component to update");
+                if constexpr(double_buffered_t<T>::value){
+                    *static_cast<T*>((*rec.archeType)[__ctype__].back_at(rec.index)) = std::move(data);
+                    return;
+                }
+                (*rec.archeType)[__ctype__].template get<T>(rec.index) = data;
+                if(_indexedMask.test(__ctype__)) _index_set(__ctype__, entity, &data);
+                if(_updateObserved.test(__ctype__)) _observers[__ctype__]->push_updated(entity);
             }
 
             template<typename T>
             void add(const entity_t entity, T data){
-                const entity_t ind = __entity_id__(entity);
-                Assert(ind < _records.size(), "Invalid entity");
                 comp_id_t c_id = __ctype__;
-                record_t& rec = _records[ind];
-                archetype_t *p_arch = rec.archeType;
-
-                Assert(!(p_arch->id & c_id), "Component already exists on the entity");
-                
-                archetype_t* n_arch = p_arch->has_plus(c_id)
-                    ? p_arch->get_plus(c_id)
-                    : p_arch->add_plus(c_id, _getNewArchetype(c_id | p_arch->id));
-
-                entry_t en = p_arch->remove_entry(rec.index);
-                en.entry[c_id] = data;
-                if(en.updatedEntity) _records[__entity_id__(en.updatedEntity)].index = rec.index;
-                en.updatedEntity = entity;
-                rec.index = n_arch->add_entry(en);
-                rec.archeType = n_arch;
+                column_t& col = _move_plus(entity, c_id);
+                _added(entity, c_id, col.emplace<T>(std::move(data)));
             }
 
             template<typename... T>
@@ -305,7 +1484,7 @@ namespace trecs {
             
             template<typename... T>
             inline void remove(entity_t entity){
-                (_remove<T>(entity), ...);
+                (_remove(entity, _get_comp_type_id<T>()), ...);
             }
             
             template<typename... T>
@@ -332,64 +1511,548 @@ namespace trecs {
             inline T& get(const entity_t entity){
                 const entity_t ind = __entity_id__(entity);
                 Assert(ind <= _records.size(), "Invalid entity");
-                Assert(_records[ind].archeType->id & __ctype__, "Entity does not have the component");
-                return std::any_cast<T&>((*_records[ind].archeType)[__ctype__]
-                        .at(_records[ind].index));
+                Assert(_records[ind].archeType->id.test(__ctype__), "Entity does not have the component");
+                return (*_records[ind].archeType)[__ctype__].template get<T>(_records[ind].index);
             }
 
             /*View Ops*/
             /*Returns the view to components*/
             template<typename... T>
             inline view_t<T...> view(){
-                view_t<T...> view((_get_comp_type_id<T>() | ...), _archetypeStore);
+                view_t<T...> view(_get_comp_mask<T...>(), _archetypeStore);
                 return view;
             }
 
+            /*Dynamic Component Ops*/
+            /*
+             * registers a component type known only at runtime (e.g. defined by a script) and
+             * returns its id for the id based add/remove/has/get/view overloads below. Its rows
+             * are raw bytes handled through ops. Ids are shared by all registries, registering
+             * an already known name returns the existing id. Names never match C++ component types
+             */
+            inline comp_id_t register_dynamic_component(const std::string& name, size_t size,
+                    size_t align, const comp_ops_t& ops = {}){
+                Assert(size && align && !(align & (align-1)) && size % align == 0,
+                        "Dynamic component needs a power of two align that divides its non zero size");
+                auto it = _dynamic_comps().find(name);
+                if(it != _dynamic_comps().end()){
+                    const comp_info_t& info = _comp_info(it->second);
+                    Assert(info.size == size && info.align == align, "Component re-registered with a different layout");
+                    Assert(info.ops.construct == ops.construct && info.ops.copy == ops.copy
+                            && info.ops.move == ops.move && info.ops.destroy == ops.destroy,
+                            "Component re-registered with different ops");
+                    return it->second;
+                }
+                const comp_id_t c_id = _register_comp_type(comp_info_t{name, size, align, ops});
+                _dynamic_comps().emplace(name, c_id);
+                return c_id;
+            }
+
+            /*adds component c_id copied from data, or default constructed if data is nullptr*/
+            inline void add(const entity_t entity, comp_id_t c_id, const void* data = nullptr){
+                column_t& col = _move_plus(entity, c_id);
+                if(data) col.push_copy(data);
+                else col.push_default();
+                _added(entity, c_id, col.at(col.size()-1));
+            }
+
+            inline void remove(const entity_t entity, comp_id_t c_id){
+                _remove(entity, c_id);
+            }
+
+            inline bool has(const entity_t entity, comp_id_t c_id){
+                Assert(__entity_id__(entity) < _records.size(), "Invalid entity");
+                return _records[__entity_id__(entity)].archeType->id.test(c_id);
+            }
+
+            inline void* get(const entity_t entity, comp_id_t c_id){
+                const entity_t ind = __entity_id__(entity);
+                Assert(ind < _records.size(), "Invalid entity");
+                Assert(_records[ind].archeType->id.test(c_id), "Entity does not have the component");
+                return (*_records[ind].archeType)[c_id].at(_records[ind].index);
+            }
+
+            /*Returns a cached random access accessor to components*/
+            template<typename... T>
+            inline accessor_t<T...> accessor(){
+                accessor_t<T...> acc(_records);
+                return acc;
+            }
+
+            /*Returns the view to components given by id*/
+            inline raw_view_t view(const std::vector<comp_id_t>& comps){
+                raw_view_t view(comps, _archetypeStore);
+                return view;
+            }
+
+            /*Double Buffer Ops*/
+            /*back buffer of a double buffered component, get() keeps reading the front one*/
+            template<typename T>
+            inline T& write(const entity_t entity){
+                static_assert(double_buffered_t<T>::value, "Component is not double buffered");
+                const entity_t ind = __entity_id__(entity);
+                Assert(ind < _records.size(), "Invalid entity");
+                Assert(_records[ind].archeType->id.test(__ctype__), "Entity does not have the component");
+                return *static_cast<T*>((*_records[ind].archeType)[__ctype__].back_at(_records[ind].index));
+            }
+
+            /*
+             * visits every T as (front, back, entity), readers of the front and this writer can
+             * run concurrently as long as no structural change happens meanwhile
+             */
+            template<typename T>
+            inline void each_buffered(const std::function<void(const T&, T&, entity_t)>& callback){
+                static_assert(double_buffered_t<T>::value, "Component is not double buffered");
+                for(auto& [a_id, arch]: _archetypeStore){
+                    if(!arch.size() || !a_id.test(__ctype__)) continue;
+                    column_t& col = arch[__ctype__];
+                    const T* front = static_cast<const T*>(col.data());
+                    T* back = static_cast<T*>(col.back_data());
+                    for(size_t i = 0; i < arch.size(); i++) callback(front[i], back[i], arch.entityAt(i));
+                }
+            }
+
+            /*
+             * publishes the back buffer of every T column by swapping it with the front one;
+             * the new back buffer holds the values from before the previous swap
+             */
+            template<typename T>
+            inline void swap_buffers(){
+                static_assert(double_buffered_t<T>::value, "Component is not double buffered");
+                const comp_id_t c_id = __ctype__;
+                for(auto& [a_id, arch]: _archetypeStore){
+                    if(!a_id.test(c_id)) continue;
+                    column_t& col = arch[c_id];
+                    col.swap_buffers();
+                    // every published value may have changed, indexes and observers see it now
+                    for(size_t i = 0; i < arch.size(); i++){
+                        if(_indexedMask.test(c_id)) _index_set(c_id, arch.entityAt(i), col.at(i));
+                        if(_updateObserved.test(c_id)) _observers[c_id]->push_updated(arch.entityAt(i));
+                    }
+                }
+            }
+
+            /*Hierarchy Ops*/
+            /*makes parent the parent of child, passing 0 as parent detaches the child*/
+            inline void set_parent(const entity_t child, const entity_t parent){
+                Assert(__entity_id__(child) < _records.size(), "Invalid entity");
+                Assert(__entity_id__(parent) < _records.size(), "Invalid parent entity");
+                if(parent) _hierarchy.attach(child, parent);
+                else _hierarchy.detach(child);
+            }
+
+            inline entity_t parent_of(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).parent : 0;
+            }
+
+            inline entity_t first_child(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).firstChild : 0;
+            }
+
+            inline entity_t next_sibling(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).nextSibling : 0;
+            }
+
+            inline uint32_t depth(const entity_t entity){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).depth : 0;
+            }
+
+            /*
+             * visits every (parent, child) pair level by level, so parents are always updated
+             * before their children; pairs where either side lacks T are skipped.
+             * Rows holding T are kept sorted by (depth, parent), re-sorting only archetypes whose
+             * rows moved or got relinked, and the parent row of every child is cached, so each
+             * level is a linear walk over the children and their (grouped) parents
+             */
+            template<typename T>
+            inline void each_hierarchical(const std::function<void(const T&, T&)>& callback){
+                const comp_id_t c_id = __ctype__;
+                hierarchy_order_t& order = _hierarchy_order(c_id);
+                for(size_t l = 1; l < _hierarchy.levels.size(); l++){
+                    for(hierarchy_span_t& span: order.spans){
+                        if(l+1 >= span.starts.size()) continue;
+                        T* rows = static_cast<T*>((*span.arch)[c_id].data());
+                        archetype_t* p_arch = nullptr;
+                        T* p_rows = nullptr;
+                        for(size_t i = span.starts[l]; i < span.starts[l+1]; i++){
+                            const hierarchy_parent_t& p = span.parents[i - span.starts[1]];
+                            if(p.arch != p_arch){
+                                p_arch = p.arch;
+                                p_rows = p_arch->id.test(c_id) ? static_cast<T*>((*p_arch)[c_id].data()) : nullptr;
+                            }
+                            if(p_rows) callback(p_rows[p.index], rows[i]);
+                        }
+                    }
+                }
+            }
+
+            /*Index Ops*/
+            /*creates a hashed index on key_fn(T), lookups by key are O(1)*/
+            template<typename T, typename F>
+            inline hash_index_t<T, index_key_t<T, F>>& index(F key_fn){
+                return _add_index<T, hash_index_t<T, index_key_t<T, F>>>(std::move(key_fn));
+            }
+
+            /*creates an ordered index on key_fn(T), lookups are O(log n) and ranges are supported*/
+            template<typename T, typename F>
+            inline ordered_index_t<T, index_key_t<T, F>>& ordered_index(F key_fn){
+                return _add_index<T, ordered_index_t<T, index_key_t<T, F>>>(std::move(key_fn));
+            }
+
+            /*Observer Ops*/
+            /*callback receives every entity that got T since the last flush_events*/
+            template<typename T>
+            inline void on_add(const typename observer_t<T>::batch_fn_t& callback){
+                _observer<T>().addHandlers.push_back(callback);
+                _addObserved.set(__ctype__);
+            }
+
+            /*callback receives every entity whose T was replaced through update/addOrUpdate*/
+            template<typename T>
+            inline void on_update(const typename observer_t<T>::batch_fn_t& callback){
+                _observer<T>().updateHandlers.push_back(callback);
+                _updateObserved.set(__ctype__);
+            }
+
+            /*callback receives the entities that lost T along with the removed components*/
+            template<typename T>
+            inline void on_remove(const typename observer_t<T>::remove_fn_t& callback){
+                _observer<T>().removeHandlers.push_back(callback);
+                _removeObserved.set(__ctype__);
+            }
+
+            /*delivers the buffered events, batched per component type*/
+            inline void flush_events(){
+                for(auto& [c_id, obs]: _observers) obs->flush();
+            }
+
+            /*Registry Ops*/
+            /*
+             * moves every entity of other into this registry, whole archetype columns at a time;
+             * returns other's entities mapped to the new ones. Entities without any component
+             * are not stored in an archetype, so they stay in other
+             */
+            inline entity_map_t merge(registry_t& other){
+                return _migrate(other, view_id_t{});
+            }
+
+            /*same as merge, but only for the entities of other matched by view (a view of other)*/
+            template<typename... T>
+            inline entity_map_t move_entities(registry_t& other, const view_t<T...>& view){
+                Assert(&view._archmap == &other._archetypeStore, "View does not belong to the source registry");
+                return _migrate(other, view.id);
+            }
+
         private:
             template<typename T>
             inline bool _has_findex(const size_t ind){
-                return __ctype__ & _records[ind].archeType->id;
+                return _records[ind].archeType->id.test(__ctype__);
             }
 
-            template<typename T>
-            inline void _remove(entity_t entity){
+            /*moves entity to the archetype with c_id added, returns the column to push c_id into*/
+            inline column_t& _move_plus(const entity_t entity, comp_id_t c_id){
+                const entity_t ind = __entity_id__(entity);
+                Assert(ind < _records.size(), "Invalid entity");
+                record_t& rec = _records[ind];
+                archetype_t *p_arch = rec.archeType;
+
+                Assert(!p_arch->id.test(c_id), "Component already exists on the entity");
+
+                archetype_t* n_arch = p_arch->has_plus(c_id)
+                    ? p_arch->get_plus(c_id)
+                    : p_arch->add_plus(c_id, _getNewArchetype(p_arch->id.with(c_id)));
+
+                entity_t updated = p_arch->move_entry(rec.index, *n_arch, entity);
+                if(updated) _records[__entity_id__(updated)].index = rec.index;
+                rec.index = n_arch->size()-1;
+                rec.archeType = n_arch;
+                return (*n_arch)[c_id];
+            }
+
+            inline void _added(const entity_t entity, comp_id_t c_id, const void* comp){
+                if(_indexedMask.test(c_id)) _index_set(c_id, entity, comp);
+                if(_addObserved.test(c_id)) _observers[c_id]->push_added(entity);
+            }
+
+            inline void _remove(entity_t entity, comp_id_t c_id){
                 const entity_t ind = __entity_id__(entity);
                 Assert(ind < _records.size(), "Invalid entity");
-                comp_id_t c_id = __ctype__;
 
                 record_t& rec = _records[ind];
                 archetype_t* p_arch = rec.archeType;
-                Assert(p_arch->id & c_id, "Attempt to remove non-existent component");
+                Assert(p_arch->id.test(c_id), "Attempt to remove non-existent component");
 
                 archetype_t* n_arch = p_arch->has_minus(c_id)
                     ? p_arch->get_minus(c_id)
-                    : p_arch->add_minus(c_id, _getNewArchetype(p_arch->id & (~c_id)));
+                    : p_arch->add_minus(c_id, _getNewArchetype(p_arch->id.without(c_id)));
 
-                entry_t en = p_arch->remove_entry(rec.index);
-                en.entry.erase(c_id);
-                if(en.updatedEntity) _records[__entity_id__(en.updatedEntity)].index = rec.index;
-                en.updatedEntity = entity;
-                rec.index = n_arch->add_entry(en);
+                if(n_arch->id) n_arch->reserve_more(1); // before the observer takes the component
+                if(_removeObserved.test(c_id)) _observers[c_id]->push_removed(entity, (*p_arch)[c_id].at(rec.index));
+                entity_t updated = p_arch->move_entry(rec.index, *n_arch, entity);
+                if(updated) _records[__entity_id__(updated)].index = rec.index;
+                rec.index = n_arch->id ? n_arch->size()-1 : 0;
                 rec.archeType = n_arch;
+                if(_indexedMask.test(c_id)) _index_erase(archetype_id_t{}.set(c_id), entity);
             }
 
             template<typename T>
             inline void _tryRemove(const entity_t entity){
-                if(has<T>(entity)) _remove<T>(entity);
+                if(has<T>(entity)) _remove(entity, __ctype__);
+            }
+
+            template<typename T, typename I, typename F>
+            inline I& _add_index(F key_fn){
+                const comp_id_t c_id = __ctype__;
+                auto idx = std::make_unique<I>(std::move(key_fn));
+                for(auto& [a_id, arch]: _archetypeStore){
+                    if(!a_id.test(c_id) || !arch.size()) continue;
+                    column_t& col = arch[c_id];
+                    for(size_t i = 0; i < arch.size(); i++) idx->set(arch.entityAt(i), col.at(i));
+                }
+                I& ref = *idx;
+                _indexes[c_id].push_back(std::move(idx));
+                _indexedMask.set(c_id);
+                return ref;
+            }
+
+            inline entity_map_t _migrate(registry_t& other, view_id_t mask){
+                Assert(&other != this, "Cannot migrate a registry into itself");
+                other.sync();
+                entity_map_t remap;
+                std::vector<entity_t> moved;
+                std::vector<std::pair<entity_t, entity_t>> links; // (old entity, old parent)
+                archetype_t* o_root = other._root;
+
+                for(auto& [a_id, src]: other._archetypeStore){
+                    if(!src.size() || !a_id.contains(mask)) continue;
+                    archetype_t* dst = _getNewArchetype(a_id);
+                    const size_t base = dst->size();
+                    // everything the loop below needs from either pool, so a refusal moves nothing
+                    dst->reserve_more(src.size());
+                    _reserve_more(_records, src.size());
+                    _reserve_more(other._recycleReg, src.size());
+                    moved.clear();
+                    for(size_t i = 0; i < src.size(); i++){
+                        const entity_t e_old = src.entityAt(i);
+                        const entity_t e_new = create();
+                        remap.emplace(e_old, e_new);
+                        moved.push_back(e_new);
+                        _records[__entity_id__(e_new)] = record_t{dst, base+i};
+
+                        other._records[__entity_id__(e_old)] = record_t{o_root, 0};
+                        other._release(e_old);
+                        if(a_id.intersects(other._indexedMask)) other._index_erase(a_id, e_old);
+                        if(other._hierarchy.linked(e_old)){
+                            links.emplace_back(e_old, other._hierarchy.node(e_old).parent);
+                        }
+                    }
+                    dst->splice(src, moved);
+                    if(a_id.intersects(_indexedMask | _addObserved)) _notify_appended(*dst, base);
+                }
+
+                for(auto& [e_old, parent]: links){
+                    auto p = remap.find(parent);
+                    if(p != remap.end()) set_parent(remap[e_old], p->second);
+                }
+                for(auto& link: links) other._hierarchy.erase(link.first);
+                return remap;
+            }
+
+            /*feeds the rows appended from base onwards to the indexes and add-observers*/
+            inline void _notify_appended(archetype_t& arch, size_t base){
+                for(auto& [c_id, col]: arch){
+                    if(_indexedMask.test(c_id)){
+                        for(auto& idx: _indexes[c_id]){
+                            for(size_t i = base; i < arch.size(); i++) idx->set(arch.entityAt(i), col.at(i));
+                        }
+                    }
+                    if(_addObserved.test(c_id)){
+                        for(size_t i = base; i < arch.size(); i++) _observers[c_id]->push_added(arch.entityAt(i));
+                    }
+                }
+            }
+
+            /*
+             * brings the sorted layout of every archetype holding c_id up to date. Only archetypes
+             * whose rows moved, or all of them after the hierarchy changed, are looked at: their
+             * rows are regrouped by depth and only the levels no longer sorted by parent are
+             * sorted again, top down so that the new position of each parent is known.
+             * Rows are moved only if that changed their order
+             */
+            inline hierarchy_order_t& _hierarchy_order(comp_id_t c_id){
+                hierarchy_order_t& order = _hierarchyOrders[c_id];
+                if(order.archetypes != _archetypeStore.size()){
+                    for(auto& [a_id, arch]: _archetypeStore){
+                        if(a_id.test(c_id) && arch.serial >= order.archetypes) order.spans.emplace_back().arch = &arch;
+                    }
+                    order.archetypes = _archetypeStore.size();
+                }
+
+                const size_t levels = _hierarchy.levels.size();
+                const std::vector<size_t>& versions = _hierarchy.levelVersions;
+                std::vector<hierarchy_span_t*> stale;
+                std::vector<std::vector<size_t>> perms;
+                for(hierarchy_span_t& span: order.spans){
+                    archetype_t& arch = *span.arch;
+                    if(span.version == arch.version && span.hierarchy == _hierarchy.version) continue;
+                    std::vector<size_t> starts(levels+2, 0);
+                    for(size_t i = 0; i < arch.size(); i++) starts[_row_depth(arch.entityAt(i), levels)+1]++;
+                    for(size_t d = 1; d < starts.size(); d++) starts[d] += starts[d-1];
+                    std::vector<size_t> perm(arch.size());
+                    std::vector<size_t> fill(starts.begin(), starts.end()-1);
+                    for(size_t i = 0; i < arch.size(); i++) perm[fill[_row_depth(arch.entityAt(i), levels)]++] = i;
+                    starts.pop_back(); // unlinked rows run to the end
+                    span.starts = std::move(starts);
+                    stale.push_back(&span);
+                    perms.push_back(std::move(perm));
+                }
+
+                if(!stale.empty()){
+                    std::vector<bool> moving(_archetypeStore.size(), false);
+                    for(hierarchy_span_t* span: stale) moving[span->arch->serial] = true;
+                    if(_placed.size() < _records.size()) _placed.resize(_records.size());
+
+                    // (parent archetype, parent row, parent, row), row last so the sort is stable
+                    using key_t = std::tuple<size_t, size_t, entity_t, size_t>;
+                    std::vector<key_t> keys;
+                    bool reordered = false; // rows of the level above changed their relative order
+                    for(size_t d = 0; d < levels; d++){
+                        bool reorders = false;
+                        for(size_t s = 0; s < stale.size(); s++){
+                            hierarchy_span_t& span = *stale[s];
+                            archetype_t& arch = *span.arch;
+                            auto b = perms[s].begin() + span.starts[d];
+                            auto e = perms[s].begin() + span.starts[d+1];
+                            // a level keeps its order unless its rows, their links or their parents' order changed
+                            const bool check = span.version != arch.version || reordered
+                                || d >= span.levelVersions.size() || span.levelVersions[d] != versions[d];
+                            if(d && check){
+                                keys.clear();
+                                for(auto it = b; it != e; ++it){
+                                    const entity_t pe = _hierarchy.node(arch.entityAt(*it)).parent;
+                                    const record_t& prec = _records[__entity_id__(pe)];
+                                    const size_t p_row = moving[prec.archeType->serial] ? _placed[__entity_id__(pe)] : prec.index;
+                                    keys.emplace_back(prec.archeType->serial, p_row, pe, *it);
+                                }
+                                if(!std::is_sorted(keys.begin(), keys.end())){
+                                    std::sort(keys.begin(), keys.end());
+                                    for(size_t k = 0; k < keys.size(); k++) b[k] = std::get<3>(keys[k]);
+                                }
+                            }
+                            for(auto it = b; it+1 < e && !reorders; ++it) reorders = *it > *(it+1);
+                            for(auto it = b; it != e; ++it){
+                                _placed[__entity_id__(arch.entityAt(*it))] = static_cast<size_t>(it - perms[s].begin());
+                            }
+                        }
+                        reordered = reorders;
+                    }
+
+                    for(size_t s = 0; s < stale.size(); s++){
+                        archetype_t& arch = *stale[s]->arch;
+                        const std::vector<size_t>& perm = perms[s];
+                        bool identity = true;
+                        for(size_t i = 0; i < perm.size() && identity; i++) identity = perm[i] == i;
+                        if(!identity){
+                            arch.permute(perm);
+                            for(size_t i = 0; i < arch.size(); i++) _records[__entity_id__(arch.entityAt(i))].index = i;
+                        }
+                        stale[s]->version = arch.version;
+                        stale[s]->hierarchy = _hierarchy.version;
+                        stale[s]->levelVersions = versions;
+                    }
+                }
+
+                // parent rows are looked up again wherever this span or a parent archetype changed
+                for(hierarchy_span_t& span: order.spans){
+                    bool changed = std::find(stale.begin(), stale.end(), &span) != stale.end();
+                    for(size_t i = 0; i < span.deps.size() && !changed; i++) changed = span.deps[i].first->version != span.deps[i].second;
+                    if(changed) _cache_parents(span);
+                }
+                return order;
+            }
+
+            /*depth of a linked entity, levels for the rest so that they sort last*/
+            inline size_t _row_depth(entity_t entity, size_t levels){
+                return _hierarchy.linked(entity) ? _hierarchy.node(entity).depth : levels;
+            }
+
+            inline void _cache_parents(hierarchy_span_t& span){
+                archetype_t& arch = *span.arch;
+                span.parents.clear();
+                span.deps.clear();
+                if(span.starts.size() < 2) return;
+                for(size_t i = span.starts[1]; i < span.starts.back(); i++){
+                    const record_t& prec = _records[__entity_id__(_hierarchy.node(arch.entityAt(i)).parent)];
+                    span.parents.push_back({prec.archeType, prec.index});
+                    if(!span.deps.empty() && span.deps.back().first == prec.archeType) continue;
+                    auto same = [&](const std::pair<archetype_t*, size_t>& dep){ return dep.first == prec.archeType; };
+                    if(std::none_of(span.deps.begin(), span.deps.end(), same)) span.deps.emplace_back(prec.archeType, prec.archeType->version);
+                }
+            }
+
+            template<typename T>
+            inline observer_t<T>& _observer(){
+                auto& obs = _observers[__ctype__];
+                if(!obs) obs = std::make_unique<observer_t<T>>();
+                return static_cast<observer_t<T>&>(*obs);
+            }
+
+            inline void _index_set(comp_id_t c_id, entity_t entity, const void* comp){
+                for(auto& idx: _indexes[c_id]) idx->set(entity, comp);
+            }
+
+            /*drops entity from the indexes of every component in comps*/
+            inline void _index_erase(archetype_id_t comps, entity_t entity){
+                for(auto& [c_id, list]: _indexes){
+                    if(!comps.test(c_id)) continue;
+                    for(auto& idx: list) idx->erase(entity);
+                }
             }
 
         private:
+            // declared first so that they outlive the containers allocating from them, on the heap
+            // so that those containers keep a valid resource when the registry is moved
+            std::unique_ptr<memory_budget_t> _budget;
+            std::unique_ptr<std::pmr::unsynchronized_pool_resource> _pool;
             entity_records_t _records;
             archetype_map_t _archetypeStore;
+            archetype_t* _root;
             recycleReg_t _recycleReg;
-            entity_t __entity_generator = 0;
+            hierarchy_t _hierarchy;
+            hierarchy_orders_t _hierarchyOrders;
+            std::vector<size_t> _placed; // scratch of _hierarchy_order, new row of each sorted entity
+            index_map_t _indexes;
+            archetype_id_t _indexedMask;
+            observer_map_t _observers;
+            archetype_id_t _addObserved;
+            archetype_id_t _updateObserved;
+            archetype_id_t _removeObserved;
+            std::atomic<entity_t> __entity_generator{0};
+            std::atomic<size_t> _recycleTaken{0}; // recycled ids reserved from the back since the last sync
+
+            /*grows vec for count more elements, at least doubling so repeated calls stay amortized*/
+            template<typename V>
+            static inline void _reserve_more(V& vec, size_t count){
+                const size_t need = vec.size() + count;
+                if(need > vec.capacity()) vec.reserve(std::max(need, 2 * vec.capacity()));
+            }
+
+            /*handle of the next generation of a destroyed entity*/
+            static inline entity_t _next_generation(entity_t entity){
+                return (((__entity_rc__(entity) >> 24) + 1) << 24) | __entity_id__(entity);
+            }
+
+            /*queues a destroyed entity for reuse, unless its generation counter is exhausted*/
+            inline void _release(entity_t entity){
+                if((__entity_rc__(entity) >> 24) < 0xff) _recycleReg.push_back(entity);
+            }
 
             inline archetype_t* _getNewArchetype(archetype_id_t id){
-                if(_archetypeStore.find(id) != _archetypeStore.end()) return &_archetypeStore[id];
-                auto& a = _archetypeStore.try_emplace(id, archetype_t{}).first->second;
-                a.id = id;
+                auto it = _archetypeStore.find(id);
+                if(it != _archetypeStore.end()) return &it->second;
+                archetype_t& a = _archetypeStore.try_emplace(id, id, _pool.get()).first->second;
+                a.serial = _archetypeStore.size()-1;
                 return &a;
             }
     };
 }
-